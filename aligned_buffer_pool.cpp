@@ -0,0 +1,103 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aligned_buffer_pool.h"
+#include "types.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef WIN_SYSTEM
+	#include <malloc.h>
+#endif
+
+using namespace std;
+
+AlignedBufferPool::AlignedBufferPool(uint32 alignment){
+	this->alignment = alignment;
+	hits = 0;
+	misses = 0;
+}
+
+AlignedBufferPool::~AlignedBufferPool(){
+	for(map<uint32 , vector<uint8*> >::iterator iterator = free_buffers.begin() ;
+		iterator != free_buffers.end() ; iterator++){
+		for(uint32 i = 0 ; i < iterator->second.size() ; i++)
+			Free(iterator->second[i]);
+	}
+}
+
+uint8* AlignedBufferPool::Allocate(uint32 size , uint32 alignment){
+	void *buffer = NULL;
+
+	/* Windows. */
+	#ifdef WIN_SYSTEM
+		buffer = _aligned_malloc(size , alignment);
+	/* Unix. */
+	#elif UNIX_SYSTEM
+		if(posix_memalign(&buffer , alignment < sizeof(void*) ? sizeof(void*) : alignment , size) != 0)
+			buffer = NULL;
+	#endif
+	if(buffer == NULL) throw bad_alloc();
+	return (uint8*)buffer;
+}
+
+void AlignedBufferPool::Free(uint8 *buffer){
+	/* Windows. */
+	#ifdef WIN_SYSTEM
+		_aligned_free(buffer);
+	/* Unix. */
+	#elif UNIX_SYSTEM
+		free(buffer);
+	#endif
+}
+
+uint8* AlignedBufferPool::Acquire(uint32 size){
+	size = RoundSize(size);
+	{
+		lock_guard<mutex> lock(free_buffers_mutex);
+		vector<uint8*> &buffers = free_buffers[size];
+		if(!buffers.empty()){
+			uint8 *buffer = buffers.back();
+			buffers.pop_back();
+			hits++;
+			return buffer;
+		}
+		misses++;
+	}
+	return Allocate(size , alignment);
+}
+
+void AlignedBufferPool::Release(uint8 *buffer , uint32 size){
+	if(buffer == NULL) return;
+	lock_guard<mutex> lock(free_buffers_mutex);
+	free_buffers[RoundSize(size)].push_back(buffer);
+}
+
+void AlignedBufferPool::GetStatistics(uint64 &hits , uint64 &misses){
+	lock_guard<mutex> lock(free_buffers_mutex);
+	hits = this->hits;
+	misses = this->misses;
+}
+
+void AlignedBufferPool::ResetStatistics(){
+	lock_guard<mutex> lock(free_buffers_mutex);
+	hits = 0;
+	misses = 0;
+}
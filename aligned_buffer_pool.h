@@ -0,0 +1,94 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Aligned Buffer Pool Module: keeps the buffers used for device I/O aligned to the device
+ * block size, as direct I/O requires, and reuses them.
+ */
+
+#ifndef YAFS_ALIGNED_BUFFER_POOL_H
+	#define YAFS_ALIGNED_BUFFER_POOL_H
+
+	#include "types.h"
+
+	#include <map>
+	#include <mutex>
+	#include <vector>
+
+	class AlignedBufferPool {
+		public:
+			/* The alignment must be a power of two. */
+			AlignedBufferPool(uint32 alignment);
+			~AlignedBufferPool();
+
+			/* The size is rounded up to the alignment. Acquire and Release can be called
+				by several threads at the same time. */
+			uint8* Acquire(uint32 size);
+			void Release(uint8 *buffer , uint32 size);
+
+			uint32 GetAlignment() const{
+				return alignment;
+			}
+
+			/* The hits are the acquired buffers that were reused and the misses the ones
+				that were allocated since the last reset. */
+			void GetStatistics(uint64 &hits , uint64 &misses);
+			void ResetStatistics();
+
+			/* A buffer of the pool that is released when it goes out of scope. */
+			class Buffer {
+				public:
+					Buffer(AlignedBufferPool *pool , uint32 size):pool(pool) , size(size){
+						data = pool->Acquire(size);
+					}
+					~Buffer(){
+						pool->Release(data , size);
+					}
+					uint8* get() const{
+						return data;
+					}
+
+				private:
+					Buffer(const Buffer&);
+					Buffer& operator=(const Buffer&);
+
+					AlignedBufferPool *pool;
+					uint32 size;
+					uint8 *data;
+			};
+
+			static uint8* Allocate(uint32 size , uint32 alignment);
+			static void Free(uint8 *buffer);
+
+		private:
+			AlignedBufferPool(const AlignedBufferPool&);
+			AlignedBufferPool& operator=(const AlignedBufferPool&);
+
+			uint32 alignment;
+			/* The released buffers indexed by their rounded size. */
+			std::map<uint32 , std::vector<uint8*> > free_buffers;
+			std::mutex free_buffers_mutex;
+			uint64 hits , misses;
+
+			uint32 RoundSize(uint32 size) const{
+				return (size + alignment - 1) & ~(alignment - 1);
+			}
+	};
+
+#endif
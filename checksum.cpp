@@ -0,0 +1,89 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checksum.h"
+#include "types.h"
+
+/* Reversed Castagnoli and IEEE 802.3 polynomials. */
+#define CRC32C_POLYNOMIAL 0x82F63B78U
+#define CRC32_POLYNOMIAL 0xEDB88320U
+
+/* The tables for the slicing-by-8 algorithm: table[k][b] is the CRC of the byte b
+	followed by k zero bytes. */
+class CRCTable {
+	public:
+		CRCTable(uint32 polynomial){
+			uint32 i , j , crc;
+
+			for(i = 0 ; i < 256 ; i++){
+				crc = i;
+				for(j = 0 ; j < 8 ; j++)
+					crc = (crc & 1) ? (crc >> 1) ^ polynomial : crc >> 1;
+				table[0][i] = crc;
+			}
+			for(i = 0 ; i < 256 ; i++){
+				for(j = 1 ; j < 8 ; j++)
+					table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xFF];
+			}
+		}
+
+		uint32 table[8][256];
+};
+
+/* Built on first use (thread safe since C++11). */
+static const CRCTable& GetCRC32CTable(){
+	static const CRCTable crc32c_table(CRC32C_POLYNOMIAL);
+	return crc32c_table;
+}
+
+static const CRCTable& GetCRC32Table(){
+	static const CRCTable crc32_table(CRC32_POLYNOMIAL);
+	return crc32_table;
+}
+
+static uint32 ComputeCRC(const CRCTable &crc_table , const void *data , size_t size , uint32 crc){
+	const uint8 *bytes = (const uint8*)data;
+	const uint32 (*table)[256] = crc_table.table;
+
+	crc = ~crc;
+	/* The bytes are combined explicitly so the result does not depend on the endianness. */
+	while(size >= 8){
+		uint32 low = crc ^ (uint32(bytes[0]) | (uint32(bytes[1]) << 8) |
+			(uint32(bytes[2]) << 16) | (uint32(bytes[3]) << 24));
+		crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+			table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+			table[3][bytes[4]] ^ table[2][bytes[5]] ^ table[1][bytes[6]] ^ table[0][bytes[7]];
+		bytes += 8;
+		size -= 8;
+	}
+	while(size > 0){
+		crc = (crc >> 8) ^ table[0][(crc ^ *bytes) & 0xFF];
+		bytes++;
+		size--;
+	}
+	return ~crc;
+}
+
+uint32 Checksum::CRC32C(const void *data , size_t size , uint32 crc){
+	return ComputeCRC(GetCRC32CTable() , data , size , crc);
+}
+
+uint32 Checksum::CRC32(const void *data , size_t size , uint32 crc){
+	return ComputeCRC(GetCRC32Table() , data , size , crc);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Checksum Module: computes checksums used to validate the files written by the program.
+ */
+
+#ifndef YAFS_CHECKSUM_H
+	#define YAFS_CHECKSUM_H
+
+	#include "types.h"
+
+	#include <cstddef>
+
+	class Checksum {
+		public:
+			/* CRC-32C (Castagnoli). The crc argument allows computing it incrementally. */
+			static uint32 CRC32C(const void *data , size_t size , uint32 crc = 0);
+			/* CRC-32 (IEEE 802.3), the one used by the GPT. */
+			static uint32 CRC32(const void *data , size_t size , uint32 crc = 0);
+	};
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * Copyright 2009 Luis Henrique O. Rios
+ * Copyright 2026 Luis Henrique O. Rios
  *
  * This file is part of YAFS.
  *
@@ -18,19 +18,24 @@
  */
 
 /**
- * String Compare Module:
+ * Device Block Module: a piece of data and the device offset where it is stored.
  */
 
-#ifndef YAFS_STRING_COMPARE_H
-	#define YAFS_STRING_COMPARE_H
+#ifndef YAFS_DEVICE_BLOCK_H
+	#define YAFS_DEVICE_BLOCK_H
 
-	#include <cstring>
+	#include "types.h"
 
-	class StringCompare {
-		public:
-			inline bool operator()(const char *a , const char *b) const{
-				return strcmp(a , b) < 0;
-			}
+	#include <vector>
+	using namespace std;
+
+	struct DeviceBlock {
+		uint64 offset;
+		vector<uint8> data;
 	};
 
+	inline bool DeviceBlockOffsetCompare(const DeviceBlock &a , const DeviceBlock &b){
+		return a.offset < b.offset;
+	}
+
 #endif
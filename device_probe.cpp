@@ -0,0 +1,321 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aligned_buffer_pool.h"
+#include "checksum.h"
+#include "device_probe.h"
+#include "pack.h"
+#include "types.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+/* Unix. */
+#ifdef UNIX_SYSTEM
+	#include <dirent.h>
+#endif
+
+using namespace std;
+
+const char DeviceProbe::SYSFS_ROOT_VARIABLE[] = "YAFS_SYSFS_ROOT";
+
+#define DEVICE_TUNING_SIGNATURE "YAFSTUNE"
+#define DEVICE_TUNING_VERSION 1
+
+/* The number of random reads timed and the size of the sequential read. */
+#define PROBE_RANDOM_READS 16
+#define PROBE_SEQUENTIAL_READ_SIZE (4U * 1024U * 1024U)
+
+/* A read slower than this comes from a disk or an USB 2 reader. */
+#define SLOW_READ_LATENCY 1000
+/* A read faster than this comes from a NVMe drive or from the system cache. */
+#define FAST_READ_LATENCY 200
+#define SLOW_READ_SPEED (30U * 1024U)
+
+#define MIN_READ_SIZE (64U * 1024U)
+#define MAX_READ_SIZE (4U * 1024U * 1024U)
+
+PACK(struct DeviceTuningHeader{
+	uint8 signature[8];
+	uint32 version;
+	/* The number of bytes probed. A different size means a different card. */
+	uint64 size;
+	uint32 scan_queue_depth;
+	uint32 read_size;
+	uint32 threads;
+	uint32 alignment;
+	/* The checksum is computed with the checksum field equal to zero. */
+	uint32 checksum;
+});
+#ifndef __APPLE__
+	static_assert(sizeof(DeviceTuningHeader) == 40, "Expecting DeviceTuningHeader with 40 bytes length");
+#endif
+
+uint32 ComputeDeviceTuningCheckSum(DeviceTuningHeader header){
+	header.checksum = 0;
+	return Checksum::CRC32C(&header , sizeof(DeviceTuningHeader));
+}
+
+/* Reads the first line of a file. */
+static bool ReadLine(const string &path , string &line){
+	ifstream file(path.c_str());
+
+	return getline(file , line) && !line.empty();
+}
+
+static uint32 ReadUInt32(const string &path){
+	string line;
+
+	return ReadLine(path , line) ? (uint32)strtoul(line.c_str() , NULL , 10) : 0;
+}
+
+/* The subdirectories of a directory, without "." and "..". */
+static void ListDirectory(const string &path , vector<string> &names){
+	#ifdef UNIX_SYSTEM
+		DIR *directory;
+		struct dirent *entry;
+
+		if((directory = opendir(path.c_str())) == NULL) return;
+		while((entry = readdir(directory)) != NULL){
+			if(strcmp(entry->d_name , ".") != 0 && strcmp(entry->d_name , "..") != 0)
+				names.push_back(entry->d_name);
+		}
+		closedir(directory);
+	#endif
+}
+
+bool DeviceProbe::ReadQueueAttributes(FileIO *file , DeviceCharacteristics &characteristics){
+	const char *root = getenv(SYSFS_ROOT_VARIABLE);
+	string block_path = string(root != NULL ? root : "/sys") + "/block/" , disk , line;
+	vector<string> disks , partitions;
+	uint32 major_number , minor_number;
+	uint64 inode;
+	stringstream device_number;
+
+	if(!file->GetDeviceNumbers(major_number , minor_number , inode)) return false;
+	device_number << major_number << ":" << minor_number;
+
+	/* The device is a disk or one of its partitions, whose directories are inside the
+		directory of the disk. */
+	ListDirectory(block_path , disks);
+	for(uint32 i = 0 ; i < disks.size() && disk.empty() ; i++){
+		if(ReadLine(block_path + disks[i] + "/dev" , line) && line == device_number.str()){
+			disk = disks[i];
+			break;
+		}
+		partitions.clear();
+		ListDirectory(block_path + disks[i] , partitions);
+		for(uint32 j = 0 ; j < partitions.size() ; j++){
+			if(ReadLine(block_path + disks[i] + "/" + partitions[j] + "/dev" , line) &&
+				line == device_number.str()){
+				disk = disks[i];
+				break;
+			}
+		}
+	}
+	if(disk.empty()) return false;
+
+	string queue_path = block_path + disk + "/queue/";
+	characteristics.has_queue_attributes = true;
+	characteristics.rotational = ReadUInt32(queue_path + "rotational") != 0;
+	characteristics.logical_block_size = ReadUInt32(queue_path + "logical_block_size");
+	characteristics.optimal_io_size = ReadUInt32(queue_path + "optimal_io_size");
+	characteristics.max_transfer_size = ReadUInt32(queue_path + "max_sectors_kb") * 1024;
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The disk \"" << disk << "\" is " << (characteristics.rotational ? "" : "not ") <<
+			"rotational and has blocks of " << characteristics.logical_block_size << " bytes, optimal I/O size of " <<
+			characteristics.optimal_io_size << " bytes and transfers up to " <<
+			characteristics.max_transfer_size << " bytes." << endl;
+	}
+	return true;
+}
+
+void DeviceProbe::MeasureReads(FileIO *file , uint64 size , DeviceCharacteristics &characteristics){
+	uint32 block_size = max(file->GetAlignment() , 4096U) , i;
+	uint32 sequential_size = (uint32)min(uint64(PROBE_SEQUENTIAL_READ_SIZE) , size - size % block_size);
+	uint64 blocks = size / block_size , position = 0x9E3779B97F4A7C15ULL;
+	vector<double> latencies;
+	uint8 *buffer;
+
+	if(blocks == 0) return;
+	buffer = AlignedBufferPool::Allocate(max(sequential_size , block_size) , block_size);
+	try{
+		/* The same blocks are read on every run, spread over the device. */
+		for(i = 0 ; i < PROBE_RANDOM_READS ; i++){
+			position = position * 6364136223846793005ULL + 1442695040888963407ULL;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			file->Read(buffer , block_size , ((position >> 16) % blocks) * block_size);
+			latencies.push_back(std::chrono::duration<double , std::micro>(
+				std::chrono::steady_clock::now() - start).count());
+		}
+		sort(latencies.begin() , latencies.end());
+		characteristics.read_latency = (uint32)latencies[latencies.size() / 2];
+
+		if(sequential_size > 0){
+			uint64 offset = (size / 2) - (size / 2) % block_size;
+			if(offset + sequential_size > size) offset = 0;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			file->Read(buffer , sequential_size , offset);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			characteristics.read_speed = (uint32)min(sequential_size / 1024.0 / max(seconds , 1e-6) ,
+				(double)0xFFFFFFFF);
+		}
+	}catch(...){
+		AlignedBufferPool::Free(buffer);
+		throw;
+	}
+	AlignedBufferPool::Free(buffer);
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The median read latency is " << characteristics.read_latency <<
+			" us and the sequential read speed is " << characteristics.read_speed << " KB/s." << endl;
+	}
+}
+
+DeviceTuning DeviceProbe::ChooseTuning(const DeviceCharacteristics &characteristics){
+	DeviceTuning tuning;
+	bool slow = characteristics.rotational || characteristics.read_latency >= SLOW_READ_LATENCY ||
+		(characteristics.read_speed != 0 && characteristics.read_speed < SLOW_READ_SPEED);
+	bool fast = !slow && characteristics.read_latency < FAST_READ_LATENCY;
+
+	/* The more directories are scanned at once, the more of their clusters are merged
+		into one read, which pays off when each read is expensive. A slow device also
+		seeks between partitions processed at the same time. */
+	if(slow){
+		tuning.scan_queue_depth = 64;
+		tuning.read_size = 256 * 1024;
+		tuning.threads = 1;
+	}else if(fast){
+		tuning.scan_queue_depth = 8;
+		tuning.read_size = MAX_READ_SIZE;
+		tuning.threads = 0;
+	}else{
+		tuning.scan_queue_depth = 32;
+		tuning.read_size = 1024 * 1024;
+		tuning.threads = 2;
+	}
+	/* A read larger than a transfer of the device is split anyway. */
+	if(characteristics.max_transfer_size != 0)
+		tuning.read_size = min(tuning.read_size , characteristics.max_transfer_size);
+	tuning.read_size = max(tuning.read_size , MIN_READ_SIZE);
+	if(characteristics.optimal_io_size != 0 && tuning.read_size >= characteristics.optimal_io_size)
+		tuning.read_size -= tuning.read_size % characteristics.optimal_io_size;
+	tuning.alignment = max(characteristics.logical_block_size , 4096U);
+	return tuning;
+}
+
+string DeviceProbe::GetCachePath(FileIO *file , const string &cache_directory){
+	#ifdef WIN_SYSTEM
+		const char separator = '\\';
+	#elif UNIX_SYSTEM
+		const char separator = '/';
+	#endif
+	uint32 major_number , minor_number;
+	uint64 inode;
+	stringstream buffer;
+
+	if(cache_directory.empty() || !file->GetDeviceNumbers(major_number , minor_number , inode))
+		return "";
+	buffer << cache_directory;
+	if(cache_directory[cache_directory.size() - 1] != separator) buffer << separator;
+	/* The partitions of a disk image have different offsets. */
+	buffer << major_number << "_" << minor_number << "_" << inode << "_" << file->GetBaseOffset() << ".tuning";
+	return buffer.str();
+}
+
+bool DeviceProbe::LoadTuning(const string &path , uint64 size , DeviceTuning &tuning){
+	DeviceTuningHeader header;
+	FILE *file;
+	bool success;
+
+	if((file = fopen(path.c_str() , "rb")) == NULL) return false;
+	success = fread(&header , sizeof(DeviceTuningHeader) , 1 , file) == 1 &&
+		!memcmp(header.signature , DEVICE_TUNING_SIGNATURE , sizeof(header.signature)) &&
+		header.version == DEVICE_TUNING_VERSION && header.size == size &&
+		header.checksum == ComputeDeviceTuningCheckSum(header);
+	fclose(file);
+	if(!success) return false;
+	tuning.scan_queue_depth = header.scan_queue_depth;
+	tuning.read_size = header.read_size;
+	tuning.threads = header.threads;
+	tuning.alignment = header.alignment;
+	return true;
+}
+
+void DeviceProbe::SaveTuning(const string &path , uint64 size , const DeviceTuning &tuning){
+	static std::atomic<uint32> temporary_file_counter(0);
+	DeviceTuningHeader header;
+	stringstream temporary_path;
+	FILE *file;
+	bool success;
+
+	memcpy(header.signature , DEVICE_TUNING_SIGNATURE , sizeof(header.signature));
+	header.version = DEVICE_TUNING_VERSION;
+	header.size = size;
+	header.scan_queue_depth = tuning.scan_queue_depth;
+	header.read_size = tuning.read_size;
+	header.threads = tuning.threads;
+	header.alignment = tuning.alignment;
+	header.checksum = ComputeDeviceTuningCheckSum(header);
+
+	/* The partitions of a device may be tuned at the same time. */
+	temporary_path << path << "." << hex <<
+		(std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+		(size_t)std::chrono::steady_clock::now().time_since_epoch().count()) <<
+		"." << temporary_file_counter++ << ".tmp";
+	if((file = fopen(temporary_path.str().c_str() , "wb")) == NULL) return;
+	success = fwrite(&header , sizeof(DeviceTuningHeader) , 1 , file) == 1;
+	success = fclose(file) == 0 && success;
+	remove(path.c_str());
+	if(!success || rename(temporary_path.str().c_str() , path.c_str()))
+		remove(temporary_path.str().c_str());
+}
+
+DeviceTuning DeviceProbe::Tune(FileIO *file , uint64 size , const string &cache_directory){
+	string cache_path = GetCachePath(file , cache_directory);
+	DeviceCharacteristics characteristics;
+	DeviceTuning tuning;
+
+	if(!cache_path.empty() && LoadTuning(cache_path , size , tuning)){
+		if(LogUtils::IsEnabled()){
+			LogUtils::Debug() << "The device tuning was loaded from \"" << cache_path << "\"." << endl;
+		}
+	}else{
+		memset(&characteristics , 0 , sizeof(DeviceCharacteristics));
+		ReadQueueAttributes(file , characteristics);
+		MeasureReads(file , size , characteristics);
+		tuning = ChooseTuning(characteristics);
+		if(!cache_path.empty()) SaveTuning(cache_path , size , tuning);
+	}
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The device is read with a queue depth of " << tuning.scan_queue_depth <<
+			", reads of up to " << tuning.read_size << " bytes, buffers aligned to " << tuning.alignment <<
+			" bytes and " << tuning.threads << " threads (0 is one per processor)." << endl;
+	}
+	return tuning;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Device Probe Module: measures how a device answers to reads and chooses how it is read.
+ */
+
+#ifndef YAFS_DEVICE_PROBE_H
+	#define YAFS_DEVICE_PROBE_H
+
+	#include "file_io.h"
+	#include "types.h"
+
+	#include <string>
+
+	using namespace std;
+
+	/* What is known about a device. The fields that are not known are zero. */
+	struct DeviceCharacteristics {
+		/* If the queue attributes were found in sysfs. */
+		bool has_queue_attributes;
+		bool rotational;
+		uint32 logical_block_size , optimal_io_size , max_transfer_size;
+		/* The median latency of a small random read, in microseconds, and the speed of a
+			sequential read, in KB per second. */
+		uint32 read_latency , read_speed;
+	};
+
+	struct DeviceTuning {
+		uint32 scan_queue_depth;
+		/* The maximum number of bytes read by a single call. */
+		uint32 read_size;
+		/* The number of devices or partitions of the same device processed at once. Zero
+			means one per processor. */
+		uint32 threads;
+		/* The alignment of the buffers. */
+		uint32 alignment;
+	};
+
+	class DeviceProbe {
+		public:
+			/* The environment variable that replaces "/sys", so a fake tree can be used. */
+			static const char SYSFS_ROOT_VARIABLE[];
+
+			/* Gets the tuning of the device (or of the partition the file offsets start at)
+				from the cache directory or probes the first size bytes of the device and
+				stores the result in the cache directory. The cache is not used if the
+				directory is empty. */
+			static DeviceTuning Tune(FileIO *file , uint64 size , const string &cache_directory);
+			/* Reads the queue attributes of the disk of the device from
+				/sys/block/<disk>/queue. */
+			static bool ReadQueueAttributes(FileIO *file , DeviceCharacteristics &characteristics);
+			/* Times some random reads and a sequential read of the first size bytes. */
+			static void MeasureReads(FileIO *file , uint64 size , DeviceCharacteristics &characteristics);
+			static DeviceTuning ChooseTuning(const DeviceCharacteristics &characteristics);
+
+		private:
+			static string GetCachePath(FileIO *file , const string &cache_directory);
+			static bool LoadTuning(const string &path , uint64 size , DeviceTuning &tuning);
+			static void SaveTuning(const string &path , uint64 size , const DeviceTuning &tuning);
+	};
+
+#endif
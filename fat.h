@@ -78,6 +78,24 @@
 		static_assert(sizeof(BIOSParameterBlockFAT32) == 28, "Expecting BIOSParameterBlockFAT32 with 28 bytes length");
 	#endif
 
+	/* The FSInfo sector is only present in FAT32. */
+	#define FSI_LEAD_SIG 0x41615252
+	#define FSI_STRUC_SIG 0x61417272
+	#define FSI_TRAIL_SIG 0xAA550000
+	#define FSI_UNKNOWN 0xFFFFFFFF
+	PACK(struct FSInfo{
+		uint32 FSI_LeadSig;
+		uint8 FSI_Reserved1[480];
+		uint32 FSI_StrucSig;
+		uint32 FSI_Free_Count;
+		uint32 FSI_Nxt_Free;
+		uint8 FSI_Reserved2[12];
+		uint32 FSI_TrailSig;
+	});
+	#ifndef __APPLE__
+		static_assert(sizeof(FSInfo) == 512, "Expecting FSInfo with 512 bytes length");
+	#endif
+
 	/* The Boot Sector is present in all FAT systems. */
 	PACK(struct BootSectorFAT{
 		uint8 BS_DrvNum;
@@ -17,17 +17,34 @@
  * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "checksum.h"
 #include "fat_device.h"
 #include "file_io.h"
+#include "partition_table.h"
 #include "types.h"
+#include "utils.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
+#include <deque>
+#include <iomanip>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 using namespace std;
 
+/* The maximum number of bytes read by a single call when the clusters of several scans are
+	contiguous, unless the device is tuned. */
+#define DEFAULT_MERGED_READ_SIZE (1024U * 1024U)
+
+const uint32 FATDevice::PROBE_ERASE_BLOCK_SIZE = 0xFFFFFFFF;
+const uint32 FATDevice::DEFAULT_ERASE_BLOCK_SIZE = 4 * 1024 * 1024;
+
 uint32 FATDevice::file_last_cluster[] = {
 	0x00000FF8,
 	0x0000FFF8,
@@ -44,10 +61,28 @@ uint8 ComputeCheckSum(uint8 *name){
    return sum;
 }
 
-FATDevice::FATDevice(const char *path, const char *access_mode){
-	std::unique_ptr<uint8[]> sector_buffer = std::unique_ptr<uint8[]>(new uint8[4096]);
+FATDevice::FATDevice(const char *path, const char *access_mode , bool direct_io){
+	/* They are released if the constructor throws. */
+	device_file = NULL;
+	buffer_pool = NULL;
+	bpb_fat32 = NULL;
+	fat_buffer = NULL;
+	subtree_directory = NULL;
+	file_allocation_table = NULL;
 	try{
-		device_file = new FileIO(path , access_mode, true);
+		string file_path;
+		uint32 partition_number;
+
+		PartitionTable::SplitDevicePath(path , file_path , partition_number);
+		device_file = new FileIO(file_path.c_str() , access_mode, true , direct_io);
+		SelectPartition(partition_number);
+		/* A page is aligned to any sector size. */
+		buffer_pool = new AlignedBufferPool(max(device_file->GetAlignment() , 4096U));
+		if(device_file->IsDirect() && LogUtils::IsEnabled()){
+			LogUtils::Debug() << "The device uses direct I/O aligned to " << device_file->GetAlignment() <<
+				" bytes." << endl;
+		}
+		AlignedBufferPool::Buffer sector_buffer(buffer_pool , 4096);
 
 		device_file->Read(sector_buffer.get() , 4096, 0);
 		memcpy(&bs_bpb , sector_buffer.get() , sizeof(BootSectorBIOSParameterBlock));
@@ -131,6 +166,9 @@ FATDevice::FATDevice(const char *path, const char *access_mode){
 		/* Calculate the number of clusters (set of sectors). */
 		total_clusters = data_sectors / bs_bpb.BPB_SecPerClus;
 
+		if(partition_size != 0 && uint64(total_sectors) * bs_bpb.BPB_BytsPerSec > partition_size)
+			throw FATDeviceException("The file system is larger than its partition.");
+
 		/* Determine the FAT type and also do some security verifications. */
 		/* FAT 12. */
 		if(total_clusters < 4085){
@@ -188,22 +226,87 @@ FATDevice::FATDevice(const char *path, const char *access_mode){
 			}
 		}
 
-		fat_buffer = new uint8[cluster_size];
+		fat_buffer = buffer_pool->Acquire(cluster_size);
 		fat_buffer_sector = 0;
+		scan_queue_depth = 0;
+		merged_read_size = DEFAULT_MERGED_READ_SIZE;
+		compact_directories = false;
+		defragment_directories = false;
+		relocate_files = false;
+		packing_policy = PACK_NONE;
+		durability_policy = DURABILITY_END;
+		erase_block_size = 0;
+		erase_block_start = 0;
+		unpacked_split_elements = 0;
+		split_elements = 0;
+		freed_clusters = 0;
+		allocated_clusters = 0;
+		relocated_directories = 0;
+		relocated_files = 0;
+		free_cluster_search = 2;
+		file_allocation_table = new FileAllocationTable(device_file , fat_type == FAT16 ? 2 : 4 ,
+			bs_bpb.BPB_BytsPerSec , fats_first_sector);
 
 	}catch(FileIO::FileIOException f_io_exception){
+		ReleaseResources();
 		throw FATDeviceException(f_io_exception);
+	}catch(PartitionTable::PartitionTableException partition_table_exception){
+		ReleaseResources();
+		throw FATDeviceException(partition_table_exception);
+	}catch(...){
+		ReleaseResources();
+		throw;
+	}
+}
+
+void FATDevice::SelectPartition(uint32 partition_number){
+	vector<PartitionTable::Partition> partitions;
+	const PartitionTable::Partition *selected = NULL;
+	stringstream buffer;
+
+	partition_size = 0;
+	if(!PartitionTable::Read(device_file , partitions)){
+		if(partition_number != 0)
+			throw FATDeviceException("The device has no partition table.");
+		return;
+	}
+	for(uint32 i = 0 ; i < partitions.size() ; i++){
+		if(partition_number != 0 ? partitions[i].number == partition_number : partitions[i].fat){
+			/* Without a number, the only FAT partition is used. */
+			if(selected != NULL)
+				throw FATDeviceException("The device has more than one FAT partition, one must be chosen.");
+			selected = &partitions[i];
+		}
+	}
+	if(selected == NULL){
+		buffer << "The device has no " ;
+		if(partition_number != 0) buffer << "partition " << partition_number << ".";
+		else buffer << "FAT partition.";
+		throw FATDeviceException(buffer.str());
+	}
+	device_file->SetBaseOffset(selected->offset);
+	partition_size = selected->size;
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The partition " << selected->number << " starts at offset " <<
+			selected->offset << " and has " << selected->size << " bytes." << endl;
 	}
 }
 
 FATDevice::~FATDevice(){
+	ReleaseResources();
+}
+
+void FATDevice::ReleaseResources(){
    if(bpb_fat32 != NULL) delete bpb_fat32;
-	delete[] fat_buffer;
+	if(buffer_pool != NULL) buffer_pool->Release(fat_buffer , cluster_size);
+	delete subtree_directory;
+	delete file_allocation_table;
    delete device_file;
+	delete buffer_pool;
 }
 
 uint64 FATDevice::GetClusterOffset(uint32 cluster){
-   assert(total_clusters > cluster && cluster >= 2 );
+   assert(total_clusters + 2 > cluster && cluster >= 2);
 	/* The clusters number 0 and 1 do not exist so
 		the first cluster is the cluster number 2. */
 	uint64 offset = (uint64(cluster - 2) * uint64(bs_bpb.BPB_SecPerClus) +
@@ -244,6 +347,7 @@ void FATDevice::WriteCluster(void* buffer , uint32 cluster){
 uint32 FATDevice::ReadFAT(uint32 cluster){
 	uint32 fat_sector , aux = 0;
 	uint8 fat_entry_size = fat_type == FAT16 ? 2 : 4;
+	std::lock_guard<std::mutex> lock(fat_buffer_mutex);
 
 	fat_sector = fats_first_sector[0] +
 		(cluster * fat_entry_size) / bs_bpb.BPB_BytsPerSec;
@@ -257,24 +361,59 @@ uint32 FATDevice::ReadFAT(uint32 cluster){
 	return aux;
 }
 
-void FATDevice::ReadDirectory(FATDirectory* fat_directory){
+bool HasEndEntry(const uint8 *data , uint32 size){
+	for(uint32 i = 0 ; i < size ; i += DIR_ENTRY_SIZE){
+		if(data[i] == DIR_ENTRY_END) return true;
+	}
+	return false;
+}
+
+void FATDevice::ReadDirectoryData(FATDirectory* fat_directory , vector<uint8> &data){
+	uint32 current_cluster , read_clusters = 0;
+	AlignedBufferPool::Buffer cluster_buffer(buffer_pool , cluster_size);
+
+	data.clear();
+	/* FAT12 and FAT16 root directory. */
+	if(fat_directory == NULL && fat_type != FAT32){
+		uint32 first_sector = fats_first_sector[fats_first_sector.size() - 1] + fat_size;
+		for(uint32 i = 0 ; i < sectors_root_directory ; i++){
+			ReadSector(cluster_buffer.get() , first_sector + i);
+			data.insert(data.end() , cluster_buffer.get() , cluster_buffer.get() + bs_bpb.BPB_BytsPerSec);
+			if(HasEndEntry(cluster_buffer.get() , bs_bpb.BPB_BytsPerSec)) break;
+		}
+		/* The root directory may not fill its last sector. */
+		if(data.size() > uint32(bs_bpb.BPB_RootEntCnt) * DIR_ENTRY_SIZE)
+			data.resize(uint32(bs_bpb.BPB_RootEntCnt) * DIR_ENTRY_SIZE);
+		return;
+	}
+
+	if(fat_directory == NULL){
+		current_cluster = bpb_fat32->BPB_RootClus;
+	}else{
+		current_cluster = (uint32(fat_directory->directory_entries.back().de.DIR_FstClusHI) << 16) |
+			uint32(fat_directory->directory_entries.back().de.DIR_FstClusLO);
+	}
+	/* The clusters after the one with the end entry are not used. */
+	while(!IsLastCluster(current_cluster) && read_clusters++ < total_clusters){
+		ReadCluster(cluster_buffer.get() , current_cluster);
+		data.insert(data.end() , cluster_buffer.get() , cluster_buffer.get() + cluster_size);
+		if(HasEndEntry(cluster_buffer.get() , cluster_size)) break;
+		current_cluster = ReadFAT(current_cluster);
+	}
+}
+
+void FATDevice::ParseDirectoryData(const vector<uint8> &data , FATDirectory* fat_directory ,
+	RootDirectory* root_directory){
 	bool reading_lde = false;
 	FATElement *fat_element;
-	GenericEntry *ge;
+	const GenericEntry *ge = (const GenericEntry*) data.data();
+	DirectoryEntryStructure de;
 	vector<LongDirectoryEntryStructure> lde;
-	std::unique_ptr<uint8[]> cluster_buffer = std::unique_ptr<uint8[]>(new uint8[cluster_size]);
-	uint32 current_cluster = 0;
-	uint32 i = 0 , total_entries = 0 , total_lde = 0;
+	uint32 i , total_entries = (uint32)(data.size() / DIR_ENTRY_SIZE) , total_lde = 0;
 	uint8 current_sum = 0;
 
-	current_cluster = (uint32(fat_directory->directory_entries.back().de.DIR_FstClusHI) << 16) |
-		uint32(fat_directory->directory_entries.back().de.DIR_FstClusLO);
-	if(IsLastCluster(current_cluster)) return;
-	ReadCluster(cluster_buffer.get() , current_cluster);
-	ge = (GenericEntry*) cluster_buffer.get();
-	
 	/* While there are more valid entries. */
-	while(ge[i].lde.LDIR_Ord != DIR_ENTRY_END){
+	for(i = 0 ; i < total_entries && ge[i].lde.LDIR_Ord != DIR_ENTRY_END ; i++){
 
       /* If the entry is not empty. */
       if(ge[i].lde.LDIR_Ord != DIR_ENTRY_EMPTY){
@@ -302,23 +441,26 @@ void FATDevice::ReadDirectory(FATDirectory* fat_directory){
 					throw FATDeviceException("The FAT file system is corrupted.");
 			/* If it is a DE. */
 			}else{
+				de = ge[i].de;
 				if((reading_lde && total_lde == 1 &&
-					ComputeCheckSum(ge[i].de.DIR_Name) == current_sum) || !reading_lde){
+					ComputeCheckSum(de.DIR_Name) == current_sum) || !reading_lde){
 
 					reading_lde = false;
 					/* Replace the byte 0x05. */
-					ge[i].de.DIR_Name[0] = ge[i].de.DIR_Name[0] == 0x05 ? 0xE5 : ge[i].de.DIR_Name[0];
+					de.DIR_Name[0] = de.DIR_Name[0] == 0x05 ? 0xE5 : de.DIR_Name[0];
 					/* Avoid the special entries "." and ".." .*/
-					if(total_entries >= 2){
-						fat_element = FATElementFactory::CreateFATElement(&ge[i].de , lde);
-						if(fat_element->IsDirectory()) ReadDirectory((FATDirectory*)fat_element);
-						fat_directory->InsertFATElement(fat_element);
-
-					} else {
-						if (total_entries == 0) {
-							fat_directory->dot = ge[i].de;
-						} else {
-							fat_directory->dotdot = ge[i].de;
+					if(fat_directory != NULL && i < 2){
+						if(i == 0){
+							fat_directory->dot = de;
+						}else{
+							fat_directory->dotdot = de;
+						}
+					}else{
+						fat_element = FATElementFactory::CreateFATElement(&de , lde);
+						if(fat_directory != NULL){
+							fat_directory->InsertFATElement(fat_element);
+						}else{
+							root_directory->InsertFATElement(fat_element);
 						}
 					}
 					lde.clear();
@@ -330,190 +472,524 @@ void FATDevice::ReadDirectory(FATDirectory* fat_directory){
 			if(reading_lde)
 				throw FATDeviceException("The FAT file system is corrupted.");
 		}
+	}
+}
+
+void FATDevice::LoadDirectory(const vector<uint8> &data , FATDirectory* fat_directory ,
+	RootDirectory* root_directory , TreeSnapshot *previous_snapshot , TreeSnapshot *next_snapshot){
+	uint32 first_cluster = 0 , fingerprint;
 
-      /* Increase the counter. */
-      i++;
-      total_entries++;
-		if(i >= (cluster_size / DIR_ENTRY_SIZE)){
-			current_cluster = ReadFAT(current_cluster);
-			if(IsLastCluster(current_cluster)) break;
-			ReadCluster(cluster_buffer.get() , current_cluster);
-			i = 0;
-      }
+	/* A directory without clusters has nothing to parse or to store. */
+	if(next_snapshot == NULL || data.empty()){
+		ParseDirectoryData(data , fat_directory , root_directory);
+	}else{
+		/* The directories are identified by their first cluster, the root directory by zero. */
+		if(fat_directory != NULL){
+			first_cluster = (uint32(fat_directory->directory_entries.back().de.DIR_FstClusHI) << 16) |
+				uint32(fat_directory->directory_entries.back().de.DIR_FstClusLO);
+		}
+		/* Only the directories whose clusters changed are parsed again. */
+		fingerprint = Checksum::CRC32C(data.data() , data.size());
+		if(!previous_snapshot->RestoreDirectory(first_cluster , fingerprint , fat_directory , root_directory))
+			ParseDirectoryData(data , fat_directory , root_directory);
+		next_snapshot->AddDirectory(first_cluster , fingerprint , fat_directory , root_directory);
 	}
 }
 
-RootDirectory* FATDevice::ReadDirectoriesTree(){
-	bool reading_lde = false;
-	FATElement *fat_element;
-	GenericEntry *ge;
-	RootDirectory* root_directory = new RootDirectory();
-	vector<LongDirectoryEntryStructure> lde;
-	std::unique_ptr<uint8[]> cluster_buffer = std::unique_ptr<uint8[]>(new uint8[cluster_size]);
-	uint32 current_cluster = 0; /* Used for FAT32. */
-	uint32 current_sector = 0; /* Used for FAT12 and FAT16. */
-	uint32 i = 0 , total_entries = 0 , total_lde = 0;
-	uint8 current_sum = 0;
+void FATDevice::ReadDirectory(FATDirectory* fat_directory , RootDirectory* root_directory ,
+	TreeSnapshot *previous_snapshot , TreeSnapshot *next_snapshot , vector<uint8> &data){
+	const vector<FATElement*> &content = fat_directory != NULL ? fat_directory->content :
+		root_directory->content;
 
-	/* FAT32. */
-   if(fat_type == FAT32){
-		current_cluster = bpb_fat32->BPB_RootClus;
-		if(IsLastCluster(current_cluster)) return root_directory;
-		ReadCluster(cluster_buffer.get() , current_cluster);
-	/* FAT12 and FAT16. */
-   }else{
-		current_sector = fats_first_sector[fats_first_sector.size() - 1] + fat_size;
-		ReadSector(cluster_buffer.get() , current_sector);
-   }
-	ge = (GenericEntry*) cluster_buffer.get();
-	
-	/* While there are more valid entries. */
-	while(ge[i].lde.LDIR_Ord != DIR_ENTRY_END){
+	ReadDirectoryData(fat_directory , data);
+	LoadDirectory(data , fat_directory , root_directory , previous_snapshot , next_snapshot);
+	for(uint32 i = 0 ; i < content.size() ; i++){
+		if(content[i]->IsDirectory())
+			ReadDirectory((FATDirectory*)content[i] , NULL , previous_snapshot , next_snapshot , data);
+	}
+}
 
-      /* If the entry is not empty. */
-      if(ge[i].lde.LDIR_Ord != DIR_ENTRY_EMPTY){
+void FATDevice::ScanDirectories(FATDirectory* fat_directory , RootDirectory* root_directory ,
+	TreeSnapshot *previous_snapshot , TreeSnapshot *next_snapshot){
+	deque<FATDirectory*> waiting_directories;
+	vector<FATDirectory*> subdirectories;
+	vector<DirectoryScan> scans;
+	/* The data of the finished scans is reused by the next ones. */
+	vector<vector<uint8> > spare_data;
+	vector<uint8> data;
+	AlignedBufferPool::Buffer buffer(buffer_pool , max(merged_read_size , cluster_size));
+	uint32 i , j , k , rounds = 0 , largest_round = 0;
+
+	/* The top directory is read as usual. Its subdirectories are the first ones waiting. */
+	ReadDirectoryData(fat_directory , data);
+	LoadDirectory(data , fat_directory , root_directory , previous_snapshot , next_snapshot);
+	if(fat_directory != NULL){
+		fat_directory->GetSubdirectories(subdirectories);
+	}else{
+		root_directory->GetSubdirectories(subdirectories);
+	}
+	waiting_directories.insert(waiting_directories.end() , subdirectories.begin() , subdirectories.end());
+
+	while(!waiting_directories.empty() || !scans.empty()){
+		/* Start the waiting directories while there is room in the queue. */
+		while(scans.size() < scan_queue_depth && !waiting_directories.empty()){
+			DirectoryScan scan;
+			scan.fat_directory = waiting_directories.front();
+			waiting_directories.pop_front();
+			scan.next_cluster = (uint32(scan.fat_directory->directory_entries.back().de.DIR_FstClusHI) << 16) |
+				uint32(scan.fat_directory->directory_entries.back().de.DIR_FstClusLO);
+			scan.read_clusters = 0;
+			if(!spare_data.empty()){
+				scan.data.swap(spare_data.back());
+				spare_data.pop_back();
+			}
+			if(IsLastCluster(scan.next_cluster)){
+				LoadDirectory(scan.data , scan.fat_directory , NULL , previous_snapshot , next_snapshot);
+				subdirectories.clear();
+				scan.fat_directory->GetSubdirectories(subdirectories);
+				waiting_directories.insert(waiting_directories.end() , subdirectories.begin() ,
+					subdirectories.end());
+				spare_data.push_back(std::move(scan.data));
+				continue;
+			}
+			scans.push_back(std::move(scan));
+		}
+		if(scans.empty()) continue;
+
+		/* All suspended scans are waiting for one cluster. They are read in ascending
+			order and the contiguous ones with a single call. */
+		sort(scans.begin() , scans.end() , [](const DirectoryScan &a , const DirectoryScan &b){
+			return a.next_cluster < b.next_cluster;
+		});
+		for(i = 0 ; i < scans.size() ; i = j + 1){
+			for(j = i ; j + 1 < scans.size() && scans[j + 1].next_cluster == scans[j].next_cluster + 1 &&
+				(j + 2 - i) * cluster_size <= merged_read_size ; j++);
+			device_file->Read(buffer.get() , (j - i + 1) * cluster_size , GetClusterOffset(scans[i].next_cluster));
+			for(k = i ; k <= j ; k++){
+				scans[k].data.insert(scans[k].data.end() , buffer.get() + (k - i) * cluster_size ,
+					buffer.get() + (k - i + 1) * cluster_size);
+			}
+		}
+		rounds++;
+		largest_round = max(largest_round , (uint32)scans.size());
+
+		/* Resume the scans. The finished ones are loaded and their subdirectories wait. */
+		for(i = 0 , k = 0 ; i < scans.size() ; i++){
+			DirectoryScan &scan = scans[i];
+			bool finished = ++scan.read_clusters >= total_clusters ||
+				HasEndEntry(scan.data.data() + scan.data.size() - cluster_size , cluster_size);
+			if(!finished){
+				scan.next_cluster = ReadFAT(scan.next_cluster);
+				finished = IsLastCluster(scan.next_cluster);
+			}
+			if(finished){
+				LoadDirectory(scan.data , scan.fat_directory , NULL , previous_snapshot , next_snapshot);
+				subdirectories.clear();
+				scan.fat_directory->GetSubdirectories(subdirectories);
+				waiting_directories.insert(waiting_directories.end() , subdirectories.begin() ,
+					subdirectories.end());
+				scan.data.clear();
+				spare_data.push_back(std::move(scan.data));
+			}else{
+				if(k != i) scans[k] = std::move(scan);
+				k++;
+			}
+		}
+		scans.resize(k);
+	}
 
-			/* If it is a LDE. */
-         if((ge[i].lde.LDIR_Attr & ATTR_LONG_NAME_MASK) == ATTR_LONG_NAME){
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The directories were read in " << rounds << " rounds with up to " <<
+			largest_round << " scans each." << endl;
+	}
+}
 
-				/* We are not reading a LDE and we have found the last LDE. */
-				if(!reading_lde && (ge[i].lde.LDIR_Ord & LAST_LONG_ENTRY)){
-					reading_lde = true;
-					total_lde = ge[i].lde.LDIR_Ord & 0xBF;
-					lde.push_back(ge[i].lde);
-					current_sum = ge[i].lde.LDIR_Chksum;
+void FATDevice::ReadDirectories(FATDirectory* fat_directory , RootDirectory* root_directory ,
+	TreeSnapshot *previous_snapshot , TreeSnapshot *next_snapshot){
+	if(scan_queue_depth > 0){
+		ScanDirectories(fat_directory , root_directory , previous_snapshot , next_snapshot);
+	}else{
+		vector<uint8> data;
+		ReadDirectory(fat_directory , root_directory , previous_snapshot , next_snapshot , data);
+	}
+}
 
-				/* We are reading a LDE and we have not found the last LDE. */
-				}else if(reading_lde && !(ge[i].lde.LDIR_Ord & LAST_LONG_ENTRY) &&
-					(ge[i].lde.LDIR_Ord & 0xBFU) == (total_lde - 1) &&
-					current_sum == ge[i].lde.LDIR_Chksum){
-					total_lde--;
-					lde.push_back(ge[i].lde);
+void FATDevice::SetScanQueueDepth(uint32 scan_queue_depth){
+	this->scan_queue_depth = scan_queue_depth;
+}
 
-				/* We are reading a LDE and we have found the last LDE or
-					we are not reading a LDE and we have not found the last LDE.*/
-				}else{
-					delete root_directory;
-					throw FATDeviceException("The FAT file system is corrupted.");
-				}
+DeviceTuning FATDevice::AutoTune(){
+	DeviceTuning tuning = DeviceProbe::Tune(device_file , uint64(total_sectors) * bs_bpb.BPB_BytsPerSec ,
+		snapshot_cache_directory);
+
+	scan_queue_depth = tuning.scan_queue_depth;
+	merged_read_size = tuning.read_size;
+	/* Only the FAT buffer is kept while the device is open. */
+	if(tuning.alignment > buffer_pool->GetAlignment() && (tuning.alignment & (tuning.alignment - 1)) == 0){
+		buffer_pool->Release(fat_buffer , cluster_size);
+		delete buffer_pool;
+		buffer_pool = new AlignedBufferPool(tuning.alignment);
+		fat_buffer = buffer_pool->Acquire(cluster_size);
+		fat_buffer_sector = 0;
+	}
+	return tuning;
+}
 
-			/* If it is a DE. */
-			}else{
-				if((reading_lde && total_lde == 1 &&
-					ComputeCheckSum(ge[i].de.DIR_Name) == current_sum) || !reading_lde){
+void FATDevice::SetCompactDirectories(bool compact_directories){
+	this->compact_directories = compact_directories;
+}
 
-					reading_lde = false;
-					/* Replace the byte 0x05. */
-					ge[i].de.DIR_Name[0] = ge[i].de.DIR_Name[0] == 0x05 ? 0xE5 : ge[i].de.DIR_Name[0];
-					fat_element = FATElementFactory::CreateFATElement(&ge[i].de , lde);
-					if(fat_element->IsDirectory()) ReadDirectory((FATDirectory*)fat_element);
-					root_directory->InsertFATElement(fat_element);
-					lde.clear();
-				}else{
-					throw FATDeviceException("The FAT file system is corrupted.");
-				}
-			}
-		}else{
-			if(reading_lde){
-				delete root_directory;
-				throw FATDeviceException("The FAT file system is corrupted.");
+void FATDevice::SetDefragmentDirectories(bool defragment_directories){
+	this->defragment_directories = defragment_directories;
+}
+
+void FATDevice::SetRelocateFiles(bool relocate_files){
+	this->relocate_files = relocate_files;
+}
+
+void FATDevice::SetPackingPolicy(PackingPolicy packing_policy){
+	this->packing_policy = packing_policy;
+}
+
+void FATDevice::SetEraseBlockSize(uint32 erase_block_size){
+	uint64 start = 0;
+
+	if(erase_block_size == PROBE_ERASE_BLOCK_SIZE){
+		if(!device_file->GetEraseBlock(erase_block_size , start)){
+			start = 0;
+			erase_block_size = DEFAULT_ERASE_BLOCK_SIZE;
+			if(LogUtils::IsEnabled()){
+				LogUtils::Debug() << "The device does not report its erase block size." << endl;
 			}
 		}
+	}
+	this->erase_block_size = erase_block_size;
+	start += device_file->GetBaseOffset();
+	/* The erase blocks are aligned to the start of the disk, not of the partition. */
+	erase_block_start = erase_block_size == 0 ? 0 : uint32((erase_block_size - start % erase_block_size) %
+		erase_block_size);
+	if(erase_block_size != 0 && LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The writes are grouped in erase blocks of " << erase_block_size <<
+			" bytes starting at offset " << erase_block_start << "." << endl;
+	}
+}
 
+void FATDevice::SetDurabilityPolicy(DurabilityPolicy durability_policy){
+	this->durability_policy = durability_policy;
+	device_file->SetSyncOnClose(durability_policy != DURABILITY_NONE);
+}
 
-      /* Increase the counter. */
-      i++;
-      total_entries++;
-		/* FAT32. */
-		if(fat_type == FAT32){
-			if(i >= (cluster_size / DIR_ENTRY_SIZE)){
-				current_cluster = ReadFAT(current_cluster);
-				if(IsLastCluster(current_cluster)) break;
-				ReadCluster(cluster_buffer.get() , current_cluster);
-				i = 0;
-			}
-		/* FAT12 and FAT16. */
-		}else{
-         if(i >= (bs_bpb.BPB_BytsPerSec / DIR_ENTRY_SIZE)){
-            /* Check if is the end of root directory. */
-            if(total_entries >= bs_bpb.BPB_RootEntCnt) break;
-            current_sector++;
-				ReadSector(cluster_buffer.get() , current_sector);
-				i = 0;
-         }
+void FATDevice::SetSnapshotCacheDirectory(const string &snapshot_cache_directory){
+	this->snapshot_cache_directory = snapshot_cache_directory;
+}
+
+string FATDevice::GetSnapshotPath(){
+	#ifdef WIN_SYSTEM
+		const char separator = '\\';
+	#elif UNIX_SYSTEM
+		const char separator = '/';
+	#endif
+	stringstream buffer;
+
+	buffer << snapshot_cache_directory;
+	if(!snapshot_cache_directory.empty() &&
+		snapshot_cache_directory[snapshot_cache_directory.size() - 1] != separator)
+		buffer << separator;
+	buffer << hex << uppercase << setw(8) << setfill('0') << GetVolumeID() << ".snapshot";
+	return buffer.str();
+}
+
+TreeSnapshotKey FATDevice::ComputeSnapshotKey(){
+	TreeSnapshotKey key;
+
+	key.volume_id = GetVolumeID();
+	memcpy(key.volume_label , bs_fat.BS_VolLab , sizeof(key.volume_label));
+	key.checksum = Checksum::CRC32C(&bs_bpb , sizeof(BootSectorBIOSParameterBlock));
+	key.checksum = Checksum::CRC32C(&bs_fat , sizeof(BootSectorFAT) , key.checksum);
+	return key;
+}
+
+void FATDevice::SetSubtreePath(const string &subtree_path){
+	this->subtree_path = subtree_path;
+}
+
+/* The names are compared ignoring the case of ASCII letters, like the FAT file system does. */
+static bool EqualNames(const uint8 *name , const string &component){
+	uint32 i;
+
+	for(i = 0 ; name[i] != '\0' && i < component.size() ; i++){
+		if(tolower(name[i]) != tolower((uint8)component[i])) return false;
+	}
+	return name[i] == '\0' && i == component.size();
+}
+
+FATDirectory* FATDevice::FindSubtreeDirectory(){
+	std::unique_ptr<RootDirectory> root_directory(new RootDirectory());
+	const vector<FATElement*> *content = &root_directory->content;
+	FATDirectory *fat_directory = NULL , *found_directory;
+	vector<string> components;
+	vector<uint8> data;
+	string component;
+	stringstream path_stream(subtree_path);
+
+	/* Both separators are accepted. */
+	while(getline(path_stream , component , '/')){
+		stringstream component_stream(component);
+		while(getline(component_stream , component , '\\'))
+			if(!component.empty()) components.push_back(component);
+	}
+	if(components.empty()) return NULL;
+
+	/* Only the directories on the path are read and only up to the subtree. */
+	ReadDirectoryData(NULL , data);
+	ParseDirectoryData(data , NULL , root_directory.get());
+	for(uint32 i = 0 ; i < components.size() ; i++){
+		found_directory = NULL;
+		for(uint32 j = 0 ; j < content->size() && found_directory == NULL ; j++){
+			FATElement *fat_element = (*content)[j];
+			if(fat_element->IsDirectory() && (EqualNames(fat_element->short_name , components[i]) ||
+				(fat_element->long_name != NULL && EqualNames(fat_element->long_name , components[i]))))
+				found_directory = (FATDirectory*)fat_element;
+		}
+		if(found_directory == NULL)
+			throw FATDeviceException("The directory \"" + subtree_path + "\" was not found.");
+		fat_directory = found_directory;
+		if(i + 1 < components.size()){
+			ReadDirectoryData(fat_directory , data);
+			ParseDirectoryData(data , fat_directory , NULL);
+			content = &fat_directory->content;
+		}
+	}
+
+	/* The directories on the path are released with the temporary root directory. */
+	return (FATDirectory*)FATElementFactory::CreateFATElement(fat_directory->directory_entries ,
+		fat_directory->short_name , fat_directory->long_name);
+}
+
+RootDirectory* FATDevice::ReadDirectoriesTree(){
+	std::unique_ptr<RootDirectory> root_directory(new RootDirectory());
+	TreeSnapshot previous_snapshot , next_snapshot;
+	TreeSnapshotKey key;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	buffer_pool->ResetStatistics();
+	delete subtree_directory;
+	subtree_directory = NULL;
+	subtree_directory = FindSubtreeDirectory();
+
+	if(snapshot_cache_directory.empty()){
+		ReadDirectories(subtree_directory , root_directory.get() , NULL , NULL);
+	}else{
+		key = ComputeSnapshotKey();
+		previous_snapshot.Load(GetSnapshotPath() , key);
+		ReadDirectories(subtree_directory , root_directory.get() , &previous_snapshot , &next_snapshot);
+		if(LogUtils::IsEnabled()){
+			LogUtils::Debug() << previous_snapshot.GetNumberOfRestoredDirectories() << " of " <<
+				next_snapshot.GetNumberOfDirectories() << " directories were restored from the tree snapshot." << endl;
 		}
+		/* The directories outside the subtree were not read and are kept. */
+		if(subtree_directory != NULL) next_snapshot.AddDirectories(previous_snapshot);
+		if(!next_snapshot.Save(GetSnapshotPath() , key))
+			cerr << "The tree snapshot \"" << GetSnapshotPath() << "\" could not be saved." << endl;
+	}
+
+	LogOperationStatistics("Reading the directories" , start);
+	MoveSubtreeContent(root_directory.get());
+	return root_directory.release();
+}
+
+void FATDevice::LogOperationStatistics(const string &operation ,
+	const std::chrono::steady_clock::time_point &start){
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	uint64 hits , misses;
+	ostringstream seconds_text;
+
+	if(!LogUtils::IsEnabled()) return;
+	buffer_pool->GetStatistics(hits , misses);
+	/* The format is set in a local stream, so it does not change the one of cout. */
+	seconds_text << fixed << setprecision(3) << seconds;
+	LogUtils::Debug() << operation << " took " << seconds_text.str() <<
+		" s and the buffer pool reused " << hits << " of " << (hits + misses) << " buffers (" <<
+		(hits + misses > 0 ? hits * 100 / (hits + misses) : 0) << "%)." << endl;
+}
+
+void FATDevice::MoveSubtreeContent(RootDirectory* root_directory){
+	/* The content of the subtree directory is handled as the content of a root directory. */
+	if(subtree_directory != NULL){
+		for(uint32 i = 0 ; i < subtree_directory->content.size() ; i++)
+			root_directory->InsertFATElement(subtree_directory->content[i]);
+		subtree_directory->content.clear();
 	}
-	return root_directory;
 }
 
-void FATDevice::WriteDirectory(FATDirectory* fat_directory){
+RootDirectory* FATDevice::ReadRootDirectory(){
+	std::unique_ptr<RootDirectory> root_directory(new RootDirectory());
+	vector<uint8> data;
+
+	delete subtree_directory;
+	subtree_directory = NULL;
+	subtree_directory = FindSubtreeDirectory();
+
+	ReadDirectoryData(subtree_directory , data);
+	ParseDirectoryData(data , subtree_directory , root_directory.get());
+	MoveSubtreeContent(root_directory.get());
+	return root_directory.release();
+}
+
+void FATDevice::ReadDirectoryContent(FATDirectory* fat_directory){
+	vector<uint8> data;
+
+	ReadDirectoryData(fat_directory , data);
+	ParseDirectoryData(data , fat_directory , NULL);
+}
+
+void FATDevice::WriteDirectoryContent(FATDirectory* fat_directory){
+	vector<DeviceBlock> blocks;
+
+	SerializeDirectoryContent(fat_directory , blocks);
+	WriteSerializedBlocks(blocks);
+}
+
+void FATDevice::WriteRootDirectoryContent(RootDirectory* root_directory){
+	vector<DeviceBlock> blocks;
+
+	SerializeDirectoriesTree(root_directory , blocks , false);
+	WriteSerializedBlocks(blocks);
+}
+
+void FATDevice::SerializeDirectoryContent(FATDirectory* fat_directory , vector<DeviceBlock> &blocks){
+	SerializeDirectory(fat_directory , blocks , false);
+}
+
+void FATDevice::WriteSerializedBlocks(vector<DeviceBlock> &blocks){
+	SerializeAllocationChanges(blocks);
+	WriteBlocks(blocks);
+}
+
+void FATDevice::SerializeDirectory(FATDirectory* fat_directory , vector<DeviceBlock> &blocks ,
+	bool recursive){
 	FATElement *fat_element;
 	GenericEntry *ge;
-	std::unique_ptr<uint8[]> cluster_buffer = std::unique_ptr<uint8[]>(new uint8[cluster_size]);
-   uint32 current_cluster = 0;
-	uint32 i = 0;
+	std::unique_ptr<AlignedBufferPool::Buffer> cluster_buffer(new AlignedBufferPool::Buffer(buffer_pool ,
+		cluster_size));
+   uint32 current_cluster = 0 , previous_cluster = 0;
+	uint32 i = 0 , padding_entries = 0 , free_entries = 0 , unpacked_position = 2 , unit_size;
 
 	current_cluster = (uint32)(fat_directory->directory_entries.back().de.DIR_FstClusHI << 16) |
 		(uint32)(fat_directory->directory_entries.back().de.DIR_FstClusLO);
 	if(IsLastCluster(current_cluster)) return;
-	ge = (GenericEntry*) cluster_buffer.get();
+	ge = (GenericEntry*) cluster_buffer->get();
 	/* Avoid the replace of special entries "." and ".." .*/
 	ge[i++].de = fat_directory->dot;
 	ge[i++].de = fat_directory->dotdot;
 
+	unit_size = (packing_policy == PACK_SECTORS ? bs_bpb.BPB_BytsPerSec : cluster_size) / DIR_ENTRY_SIZE;
+	if(packing_policy != PACK_NONE){
+		free_entries = GetChainEntries(current_cluster) - i;
+		for(uint32 j = 0 ; j < fat_directory->content.size() ; j++){
+			uint32 size = (uint32)fat_directory->content[j]->directory_entries.size();
+			free_entries = free_entries > size ? free_entries - size : 0;
+		}
+	}
+
 	for(uint32 j = 0 ; j < fat_directory->content.size() ; j++){
 		fat_element = fat_directory->content[j];
-		for(uint32 k = 0 ; k < fat_element->directory_entries.size() ; k++){
-			ge[i] = fat_element->directory_entries[k];
+		if(packing_policy != PACK_NONE){
+			padding_entries = GetPaddingEntries(i , unpacked_position ,
+				(uint32)fat_element->directory_entries.size() , unit_size , free_entries);
+		}
+		for(uint32 k = 0 ; k < padding_entries + fat_element->directory_entries.size() ; k++){
+			if(k < padding_entries){
+				memset(&(ge[i]) , 0 , DIR_ENTRY_SIZE);
+				ge[i].de.DIR_Name[0] = DIR_ENTRY_EMPTY;
+			}else{
+				ge[i] = fat_element->directory_entries[k - padding_entries];
+			}
 
 			/* Increase the counter. */
 			i++;
 			if(i >= (cluster_size / DIR_ENTRY_SIZE)){
-				WriteCluster(cluster_buffer.get() , current_cluster);
-				current_cluster = ReadFAT(current_cluster);
+				AppendBlock(blocks , cluster_buffer->get() , cluster_size , GetClusterOffset(current_cluster));
+				previous_cluster = current_cluster;
+				current_cluster = file_allocation_table->Get(current_cluster);
 				i = 0;
 			}
 		}
 	}
 
-	while(!IsLastCluster(current_cluster)){
-		memset(&(ge[i]) , 0 , DIR_ENTRY_SIZE);
-		i++;
-		if(i >= (cluster_size / DIR_ENTRY_SIZE)){
-			WriteCluster(cluster_buffer.get() , current_cluster);
-			current_cluster = ReadFAT(current_cluster);
-			i = 0;
-		}
-	}
-	delete[] cluster_buffer.release();
+	SerializeDirectoryTail(ge , i , current_cluster , previous_cluster , blocks);
+	cluster_buffer.reset();
+	if(!recursive) return;
 	for(i = 0 ; i < fat_directory->content.size() ; i++){
 		fat_element = fat_directory->content[i];
-		if(fat_element->IsDirectory()) WriteDirectory((FATDirectory*)fat_element);
+		if(fat_element->IsDirectory()) SerializeDirectory((FATDirectory*)fat_element , blocks);
 	}
 }
 
-void FATDevice::WriteDirectoriesTree(RootDirectory* root_directory){
+void FATDevice::SerializeDirectoriesTree(RootDirectory* root_directory , vector<DeviceBlock> &blocks ,
+	bool recursive){
 	FATElement *fat_element;
+
+	if(defragment_directories && recursive){
+		free_cluster_search = 2;
+		RelocateDirectories(root_directory->content);
+	}
+
+	/* Only the subtree is written. Its directory lends the content of the root directory. */
+	if(subtree_directory != NULL){
+		subtree_directory->content.swap(root_directory->content);
+		try{
+			SerializeDirectory(subtree_directory , blocks , recursive);
+		}catch(...){
+			subtree_directory->content.swap(root_directory->content);
+			throw;
+		}
+		subtree_directory->content.swap(root_directory->content);
+		return;
+	}
+
 	GenericEntry *ge;
-	std::unique_ptr<uint8[]> cluster_buffer = std::unique_ptr<uint8[]>(new uint8[cluster_size]);
-	uint32 current_cluster = 0; /* Used for FAT32. */
+	std::unique_ptr<AlignedBufferPool::Buffer> cluster_buffer(new AlignedBufferPool::Buffer(buffer_pool ,
+		cluster_size));
+	uint32 current_cluster = 0 , previous_cluster = 0; /* Used for FAT32. */
 	uint32 current_sector = 0; /* Used for FAT12 and FAT16. */
-	uint32 i = 0 , total_entries = 0;
+	uint32 i = 0 , total_entries = 0 , padding_entries = 0 , free_entries = 0 , unpacked_position = 0 ,
+		unit_size;
 
 	/* FAT32. */
    if(fat_type == FAT32){
 		current_cluster = bpb_fat32->BPB_RootClus;
 		if(IsLastCluster(current_cluster)) return;
-	/* FAT12 and FAT16. */
+		unit_size = (packing_policy == PACK_SECTORS ? bs_bpb.BPB_BytsPerSec : cluster_size) / DIR_ENTRY_SIZE;
+		if(packing_policy != PACK_NONE) free_entries = GetChainEntries(current_cluster);
+	/* FAT12 and FAT16. The root directory is written one sector at a time. */
    }else{
 		current_sector = fats_first_sector[fats_first_sector.size() - 1] + fat_size;
+		unit_size = bs_bpb.BPB_BytsPerSec / DIR_ENTRY_SIZE;
+		free_entries = bs_bpb.BPB_RootEntCnt;
    }
-	ge = (GenericEntry*)cluster_buffer.get();
+	ge = (GenericEntry*)cluster_buffer->get();
+
+	if(packing_policy != PACK_NONE){
+		for(uint32 j = 0 ; j < root_directory->content.size() ; j++){
+			uint32 size = (uint32)root_directory->content[j]->directory_entries.size();
+			free_entries = free_entries > size ? free_entries - size : 0;
+		}
+	}
 
 	for(uint32 j = 0 ; j < root_directory->content.size() ; j++){
 		fat_element = root_directory->content[j];
-		for(uint32 k = 0 ; k < fat_element->directory_entries.size() ; k++){
-			ge[i] = fat_element->directory_entries[k];
+		if(packing_policy != PACK_NONE){
+			padding_entries = GetPaddingEntries(i , unpacked_position ,
+				(uint32)fat_element->directory_entries.size() , unit_size , free_entries);
+		}
+		for(uint32 k = 0 ; k < padding_entries + fat_element->directory_entries.size() ; k++){
+			if(k < padding_entries){
+				memset(&(ge[i]) , 0 , DIR_ENTRY_SIZE);
+				ge[i].de.DIR_Name[0] = DIR_ENTRY_EMPTY;
+			}else{
+				ge[i] = fat_element->directory_entries[k - padding_entries];
+			}
 
 			/* Increase the counter. */
 			i++;
@@ -521,14 +997,16 @@ void FATDevice::WriteDirectoriesTree(RootDirectory* root_directory){
 			/* FAT32. */
 			if(fat_type == FAT32){
 				if(i >= (cluster_size / DIR_ENTRY_SIZE)){
-					WriteCluster(cluster_buffer.get() , current_cluster);
-					current_cluster = ReadFAT(current_cluster);
+					AppendBlock(blocks , cluster_buffer->get() , cluster_size , GetClusterOffset(current_cluster));
+					previous_cluster = current_cluster;
+					current_cluster = file_allocation_table->Get(current_cluster);
 					i = 0;
 				}
 			/* FAT12 and FAT16. */
 			}else{
 				if(i >= (bs_bpb.BPB_BytsPerSec / DIR_ENTRY_SIZE)){
-					WriteSector(cluster_buffer.get() , current_sector);
+					AppendBlock(blocks , cluster_buffer->get() , bs_bpb.BPB_BytsPerSec ,
+						uint64(current_sector) * uint64(bs_bpb.BPB_BytsPerSec));
 					/* Check if is the end of root directory. */
 					if(total_entries >= bs_bpb.BPB_RootEntCnt) break;
 					current_sector++;
@@ -540,15 +1018,7 @@ void FATDevice::WriteDirectoriesTree(RootDirectory* root_directory){
 
 	/* FAT32. */
 	if(fat_type == FAT32){
-		while(!IsLastCluster(current_cluster)){
-			memset(&(ge[i]) , 0 , DIR_ENTRY_SIZE);
-			i++;
-			if(i >= (cluster_size / DIR_ENTRY_SIZE)){
-				WriteCluster(cluster_buffer.get() , current_cluster);
-				current_cluster = ReadFAT(current_cluster);
-				i = 0;
-			}
-		}
+		SerializeDirectoryTail(ge , i , current_cluster , previous_cluster , blocks);
 	/* FAT12 and FAT16. */
 	}else{
 		while(total_entries < bs_bpb.BPB_RootEntCnt){
@@ -556,18 +1026,628 @@ void FATDevice::WriteDirectoriesTree(RootDirectory* root_directory){
 			i++;
 			total_entries++;
 			if(i >= (bs_bpb.BPB_BytsPerSec / DIR_ENTRY_SIZE)){
-				WriteSector(cluster_buffer.get() , current_sector);
+				AppendBlock(blocks , cluster_buffer->get() , bs_bpb.BPB_BytsPerSec ,
+						uint64(current_sector) * uint64(bs_bpb.BPB_BytsPerSec));
 				/* Check if is the end of root directory. */
 				current_sector++;
 				i = 0;
 			}
 		}
 	}
-	delete[] cluster_buffer.release();
+	cluster_buffer.reset();
+	if(!recursive) return;
 	for(i = 0 ; i < root_directory->content.size() ; i++){
 		fat_element = root_directory->content[i];
-		if(fat_element->IsDirectory()) WriteDirectory((FATDirectory*)fat_element);
+		if(fat_element->IsDirectory()) SerializeDirectory((FATDirectory*)fat_element , blocks);
+	}
+}
+
+void FATDevice::SerializeDirectoryTail(GenericEntry *ge , uint32 i , uint32 current_cluster ,
+	uint32 previous_cluster , vector<DeviceBlock> &blocks){
+	uint32 last_cluster;
+
+	if(!compact_directories){
+		while(!IsLastCluster(current_cluster)){
+			memset(&(ge[i]) , 0 , DIR_ENTRY_SIZE);
+			i++;
+			if(i >= (cluster_size / DIR_ENTRY_SIZE)){
+				AppendBlock(blocks , (uint8*)ge , cluster_size , GetClusterOffset(current_cluster));
+				current_cluster = file_allocation_table->Get(current_cluster);
+				i = 0;
+			}
+		}
+		return;
+	}
+
+	/* The current cluster is kept if it has entries or if it is the only one. A
+		directory whose last cluster is full does not need an end entry. */
+	if(IsLastCluster(current_cluster)) return;
+	if(i > 0 || previous_cluster == 0){
+		memset(&(ge[i]) , 0 , cluster_size - i * DIR_ENTRY_SIZE);
+		AppendBlock(blocks , (uint8*)ge , cluster_size , GetClusterOffset(current_cluster));
+		last_cluster = current_cluster;
+		current_cluster = file_allocation_table->Get(current_cluster);
+	}else{
+		last_cluster = previous_cluster;
+	}
+	if(IsLastCluster(current_cluster)) return;
+	file_allocation_table->Set(last_cluster , file_allocation_table->GetEndOfChain());
+	FreeClusterChain(current_cluster);
+}
+
+uint32 FATDevice::GetPaddingEntries(uint32 position , uint32 &unpacked_position , uint32 size ,
+	uint32 unit_size , uint32 &free_entries){
+	uint32 padding_entries = 0;
+
+	if(unpacked_position % unit_size + size > unit_size) unpacked_split_elements++;
+	unpacked_position += size;
+	if(position % unit_size + size > unit_size){
+		/* An element larger than the unit is always split. */
+		if(size <= unit_size && unit_size - position % unit_size <= free_entries){
+			padding_entries = unit_size - position % unit_size;
+			free_entries -= padding_entries;
+		}else{
+			split_elements++;
+		}
 	}
+	return padding_entries;
+}
+
+uint32 FATDevice::GetChainEntries(uint32 first_cluster){
+	uint32 cluster , clusters = 0;
+
+	for(cluster = first_cluster ; !IsLastCluster(cluster) && cluster < total_clusters + 2 ;
+		cluster = file_allocation_table->Get(cluster)) clusters++;
+	return clusters * (cluster_size / DIR_ENTRY_SIZE);
+}
+
+void FATDevice::FreeClusterChain(uint32 cluster){
+	uint32 next_cluster;
+
+	while(!IsLastCluster(cluster) && cluster >= 2 && cluster < total_clusters + 2){
+		next_cluster = file_allocation_table->Get(cluster);
+		file_allocation_table->Set(cluster , 0);
+		freed_clusters++;
+		cluster = next_cluster;
+	}
+}
+
+void FATDevice::RelocateDirectories(const vector<FATElement*> &content){
+	FATDirectory *fat_directory;
+
+	for(uint32 i = 0 ; i < content.size() ; i++){
+		if(!content[i]->IsDirectory()) continue;
+		fat_directory = (FATDirectory*)content[i];
+		if(!RelocateDirectory(fat_directory) && LogUtils::IsEnabled()){
+			LogUtils::Debug() << "There are not enough contiguous free clusters to move a directory." << endl;
+		}
+		RelocateDirectories(fat_directory->content);
+	}
+}
+
+bool FATDevice::RelocateDirectory(FATDirectory* fat_directory){
+	DirectoryEntryStructure &de = fat_directory->directory_entries.back().de;
+	uint32 first_cluster = (uint32)(de.DIR_FstClusHI << 16) | (uint32)(de.DIR_FstClusLO);
+	uint32 entries_per_cluster = cluster_size / DIR_ENTRY_SIZE;
+	uint32 cluster , chain_size = 0 , contiguous_size = 0 , needed_clusters , total_entries = 2;
+
+	if(IsLastCluster(first_cluster)) return true;
+	for(cluster = first_cluster ; !IsLastCluster(cluster) && cluster < total_clusters + 2 ;
+		cluster = file_allocation_table->Get(cluster)){
+		if(contiguous_size == chain_size && cluster == first_cluster + chain_size) contiguous_size++;
+		chain_size++;
+	}
+
+	/* With compaction, only the clusters that will be kept must be contiguous. */
+	if(compact_directories){
+		for(uint32 i = 0 ; i < fat_directory->content.size() ; i++)
+			total_entries += (uint32)fat_directory->content[i]->directory_entries.size();
+		needed_clusters = (total_entries + entries_per_cluster - 1) / entries_per_cluster;
+	}else{
+		needed_clusters = chain_size;
+	}
+	if(contiguous_size >= needed_clusters) return true;
+
+	cluster = FindFreeClusters(needed_clusters);
+	if(cluster == 0) return false;
+	for(uint32 i = 0 ; i < needed_clusters ; i++){
+		file_allocation_table->Set(cluster + i , i + 1 < needed_clusters ? cluster + i + 1 :
+			file_allocation_table->GetEndOfChain());
+	}
+	allocated_clusters += needed_clusters;
+	FreeClusterChain(first_cluster);
+
+	/* The entry in the parent directory, the "." entry and the ".." entries of the
+		subdirectories point to the new clusters. */
+	SetFirstCluster(de , cluster);
+	SetFirstCluster(fat_directory->dot , cluster);
+	for(uint32 i = 0 ; i < fat_directory->content.size() ; i++){
+		if(fat_directory->content[i]->IsDirectory())
+			SetFirstCluster(((FATDirectory*)fat_directory->content[i])->dotdot , cluster);
+	}
+	relocated_directories++;
+	return true;
+}
+
+bool FATDevice::RelocateFiles(const vector<FATElement*> &content){
+	uint32 first_cluster , new_first_cluster , cluster , chain_size;
+	bool is_contiguous;
+
+	for(uint32 i = 0 ; i < content.size() ; i++){
+		if(content[i]->IsDirectory()){
+			if(!RelocateFiles(((FATDirectory*)content[i])->content)) return false;
+			continue;
+		}
+		DirectoryEntryStructure &de = content[i]->directory_entries.back().de;
+		first_cluster = (uint32)(de.DIR_FstClusHI << 16) | (uint32)(de.DIR_FstClusLO);
+		if(IsLastCluster(first_cluster)) continue;
+
+		chain_size = 0;
+		is_contiguous = true;
+		for(cluster = first_cluster ; !IsLastCluster(cluster) && cluster < total_clusters + 2 ;
+			cluster = file_allocation_table->Get(cluster)){
+			if(cluster != first_cluster + chain_size) is_contiguous = false;
+			chain_size++;
+		}
+
+		/* The file stays if it is contiguous and after the files already in order, so a
+			second run with the same order moves nothing. */
+		if(is_contiguous && first_cluster >= free_cluster_search){
+			free_cluster_search = first_cluster + chain_size;
+			continue;
+		}
+
+		new_first_cluster = FindFreeClusters(chain_size);
+		if(new_first_cluster == 0) return false;
+		CopyFileData(first_cluster , new_first_cluster , chain_size);
+		for(uint32 j = 0 ; j < chain_size ; j++){
+			file_allocation_table->Set(new_first_cluster + j , j + 1 < chain_size ?
+				new_first_cluster + j + 1 : file_allocation_table->GetEndOfChain());
+		}
+		allocated_clusters += chain_size;
+		FreeClusterChain(first_cluster);
+		SetFirstCluster(de , new_first_cluster);
+		relocated_files++;
+	}
+	return true;
+}
+
+void FATDevice::CopyFileData(uint32 first_cluster , uint32 new_first_cluster , uint32 chain_size){
+	uint32 buffer_clusters = max(merged_read_size / cluster_size , 1U) , buffered_clusters = 0 ,
+		written_clusters = 0 , cluster = first_cluster , run_size;
+	AlignedBufferPool::Buffer buffer(buffer_pool , buffer_clusters * cluster_size);
+
+	while(written_clusters < chain_size){
+		/* Reads the contiguous clusters of the chain at once. */
+		for(run_size = 1 ; buffered_clusters + run_size < buffer_clusters &&
+			written_clusters + buffered_clusters + run_size < chain_size &&
+			file_allocation_table->Get(cluster + run_size - 1) == cluster + run_size ; run_size++);
+		device_file->Read(buffer.get() + buffered_clusters * cluster_size , run_size * cluster_size ,
+			GetClusterOffset(cluster));
+		buffered_clusters += run_size;
+		cluster = file_allocation_table->Get(cluster + run_size - 1);
+
+		if(buffered_clusters == buffer_clusters || written_clusters + buffered_clusters == chain_size){
+			device_file->Write(buffer.get() , buffered_clusters * cluster_size ,
+				GetClusterOffset(new_first_cluster + written_clusters));
+			written_clusters += buffered_clusters;
+			buffered_clusters = 0;
+		}
+	}
+}
+
+uint32 FATDevice::FindFreeClusters(uint32 count){
+	uint32 first_cluster = free_cluster_search , cluster;
+
+	/* The clusters freed since the FAT was last written still hold data the device
+		points to, so they are not used until the FAT is written. */
+	for(cluster = free_cluster_search ; cluster < total_clusters + 2 ; cluster++){
+		if(file_allocation_table->Get(cluster) != 0 || file_allocation_table->GetOnDevice(cluster) != 0){
+			first_cluster = cluster + 1;
+		}else if(cluster - first_cluster + 1 == count){
+			free_cluster_search = cluster + 1;
+			return first_cluster;
+		}
+	}
+	return 0;
+}
+
+void FATDevice::SerializeAllocationChanges(vector<DeviceBlock> &blocks){
+	if(packing_policy != PACK_NONE && LogUtils::IsEnabled()){
+		LogUtils::Debug() << unpacked_split_elements << " elements would be split between two " <<
+			(packing_policy == PACK_SECTORS ? "sectors" : "clusters") << " and " << split_elements <<
+			" were split." << endl;
+	}
+	unpacked_split_elements = 0;
+	split_elements = 0;
+	if(!file_allocation_table->HasChanges()){
+		file_allocation_table->DiscardChanges();
+		return;
+	}
+	file_allocation_table->SerializeChanges(blocks);
+
+	/* The free count is only updated if it is known. */
+	if(fat_type == FAT32 && bpb_fat32->BPB_FSInfo != 0 && bpb_fat32->BPB_FSInfo != 0xFFFF){
+		AlignedBufferPool::Buffer sector_buffer(buffer_pool , bs_bpb.BPB_BytsPerSec);
+		FSInfo fs_info;
+
+		ReadSector(sector_buffer.get() , bpb_fat32->BPB_FSInfo);
+		memcpy(&fs_info , sector_buffer.get() , sizeof(FSInfo));
+		if(fs_info.FSI_LeadSig == FSI_LEAD_SIG && fs_info.FSI_StrucSig == FSI_STRUC_SIG &&
+			fs_info.FSI_TrailSig == FSI_TRAIL_SIG && fs_info.FSI_Free_Count != FSI_UNKNOWN){
+			fs_info.FSI_Free_Count = fs_info.FSI_Free_Count + freed_clusters - allocated_clusters;
+			memcpy(sector_buffer.get() , &fs_info , sizeof(FSInfo));
+			AppendBlock(blocks , sector_buffer.get() , bs_bpb.BPB_BytsPerSec ,
+				uint64(bpb_fat32->BPB_FSInfo) * uint64(bs_bpb.BPB_BytsPerSec));
+		}
+	}
+	if(LogUtils::IsEnabled()){
+		if(relocated_files > 0){
+			LogUtils::Debug() << relocated_files << " files were moved." << endl;
+		}
+		if(relocated_directories > 0){
+			LogUtils::Debug() << relocated_directories << " directories were moved to " <<
+				allocated_clusters << " contiguous clusters." << endl;
+		}
+		LogUtils::Debug() << freed_clusters << " directory clusters were freed." << endl;
+	}
+	file_allocation_table->DiscardChanges();
+	freed_clusters = 0;
+	allocated_clusters = 0;
+	relocated_directories = 0;
+	relocated_files = 0;
+}
+
+void FATDevice::AppendBlock(vector<DeviceBlock> &blocks , const uint8 *buffer , uint32 size , uint64 offset){
+	blocks.push_back(DeviceBlock());
+	blocks.back().offset = offset;
+	blocks.back().data.assign(buffer , buffer + size);
+}
+
+void FATDevice::WriteDirectoriesTree(RootDirectory* root_directory , Journal *journal){
+	vector<DeviceBlock> blocks , original_blocks;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	buffer_pool->ResetStatistics();
+	/* The files are copied to clusters that are free, so the device is only changed
+		when the directories and the FAT are written. */
+	if(relocate_files){
+		free_cluster_search = 2;
+		if(!RelocateFiles(root_directory->content) && LogUtils::IsEnabled()){
+			LogUtils::Debug() << "There are not enough contiguous free clusters to move all files." << endl;
+		}
+		/* The directories must not point to clusters whose copy did not reach the device,
+			so the copies are flushed with every policy that flushes the device. */
+		if(relocated_files > 0 && durability_policy != DURABILITY_NONE) device_file->Sync();
+	}
+	SerializeDirectoriesTree(root_directory , blocks);
+	SerializeAllocationChanges(blocks);
+	if(journal == NULL){
+		WriteBlocks(blocks);
+	}else{
+		/* Only the blocks whose content changes are saved and written. */
+		SelectChangedBlocks(blocks , original_blocks);
+		for(uint32 i = 0 ; i < original_blocks.size() ; i++){
+			journal->AddBlock(original_blocks[i].offset , original_blocks[i].data.data() ,
+				(uint32)original_blocks[i].data.size());
+		}
+		WriteBlocksWithJournal(blocks , journal);
+	}
+	LogOperationStatistics("Writing the directories" , start);
+}
+
+void FATDevice::SelectChangedBlocks(vector<DeviceBlock> &blocks , vector<DeviceBlock> &original_blocks){
+	vector<DeviceBlock> changed_blocks;
+	DeviceBlock original_block;
+	uint32 i;
+
+	for(i = 0 ; i < blocks.size() ; i++){
+		original_block.offset = blocks[i].offset;
+		original_block.data.resize(blocks[i].data.size());
+		device_file->Read(original_block.data.data() , (uint32)original_block.data.size() ,
+			original_block.offset);
+		if(original_block.data != blocks[i].data){
+			original_blocks.push_back(original_block);
+			changed_blocks.push_back(DeviceBlock());
+			changed_blocks.back().offset = blocks[i].offset;
+			changed_blocks.back().data.swap(blocks[i].data);
+		}
+	}
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << changed_blocks.size() << " of " << blocks.size() <<
+			" blocks will be changed." << endl;
+	}
+	blocks.swap(changed_blocks);
+}
+
+void FATDevice::WriteBlocksWithJournal(const vector<DeviceBlock> &blocks , Journal *journal){
+	if(erase_block_size != 0) AddEraseBlockGaps(blocks , journal);
+	journal->Prepare(GetVolumeID());
+	WriteBlocks(blocks);
+	/* The journal can only be marked as committed after the device was flushed. The
+		ordered writes are already flushed. */
+	if(durability_policy == DURABILITY_END) device_file->Sync();
+	journal->Commit();
+}
+
+uint32 FATDevice::ComputeMetadataChecksum(){
+	uint32 sectors_buffer_size = cluster_size , sector = 0 , crc;
+	AlignedBufferPool::Buffer buffer(buffer_pool , sectors_buffer_size);
+
+	ReadSector(buffer.get() , 0);
+	crc = Checksum::CRC32C(buffer.get() , bs_bpb.BPB_BytsPerSec);
+	/* Only the first FAT is used, the other ones are copies. */
+	while(sector < fat_size){
+		uint32 sectors = min(fat_size - sector , sectors_buffer_size / bs_bpb.BPB_BytsPerSec);
+		device_file->Read(buffer.get() , sectors * bs_bpb.BPB_BytsPerSec ,
+			uint64(fats_first_sector[0] + sector) * uint64(bs_bpb.BPB_BytsPerSec));
+		crc = Checksum::CRC32C(buffer.get() , sectors * bs_bpb.BPB_BytsPerSec , crc);
+		sector += sectors;
+	}
+	return crc;
+}
+
+void FATDevice::CreateWritePlan(RootDirectory* root_directory , WritePlan &write_plan ,
+	bool only_changed_blocks){
+	vector<DeviceBlock> blocks , original_blocks;
+	uint32 i;
+
+	SerializeDirectoriesTree(root_directory , blocks);
+	SerializeAllocationChanges(blocks);
+	if(only_changed_blocks){
+		SelectChangedBlocks(blocks , original_blocks);
+	}else{
+		original_blocks.resize(blocks.size());
+		for(i = 0 ; i < blocks.size() ; i++){
+			original_blocks[i].offset = blocks[i].offset;
+			original_blocks[i].data.resize(blocks[i].data.size());
+			device_file->Read(original_blocks[i].data.data() , (uint32)original_blocks[i].data.size() ,
+				original_blocks[i].offset);
+		}
+	}
+	for(i = 0 ; i < blocks.size() ; i++){
+		write_plan.AddBlock(blocks[i].offset , blocks[i].data.data() , (uint32)blocks[i].data.size() ,
+			Checksum::CRC32C(original_blocks[i].data.data() , original_blocks[i].data.size()));
+	}
+	write_plan.SetVolumeID(GetVolumeID());
+	write_plan.SetMetadataChecksum(ComputeMetadataChecksum());
+}
+
+void FATDevice::ApplyWritePlan(const WritePlan &write_plan , Journal *journal){
+	const vector<DeviceBlock> &blocks = write_plan.GetBlocks();
+	const vector<uint32> &original_checksums = write_plan.GetOriginalChecksums();
+	uint64 device_size = uint64(total_sectors) * uint64(bs_bpb.BPB_BytsPerSec);
+	vector<DeviceBlock> changed_blocks;
+	vector<uint8> original_data;
+
+	if(write_plan.GetVolumeID() != GetVolumeID())
+		throw FATDeviceException("The plan was not created for this device.");
+	if(write_plan.GetMetadataChecksum() != ComputeMetadataChecksum())
+		throw FATDeviceException("The boot sector or the FAT has changed since the plan was created.");
+
+	for(uint32 i = 0 ; i < blocks.size() ; i++){
+		if(blocks[i].offset + blocks[i].data.size() > device_size)
+			throw FATDeviceException("The plan has a block outside the device.");
+		original_data.resize(blocks[i].data.size());
+		device_file->Read(original_data.data() , (uint32)original_data.size() , blocks[i].offset);
+		if(Checksum::CRC32C(original_data.data() , original_data.size()) != original_checksums[i])
+			throw FATDeviceException("The directories have changed since the plan was created.");
+		/* A plan may also have blocks that are only verified. */
+		if(original_data == blocks[i].data) continue;
+		if(journal != NULL)
+			journal->AddBlock(blocks[i].offset , original_data.data() , (uint32)original_data.size());
+		changed_blocks.push_back(blocks[i]);
+	}
+
+	if(journal != NULL){
+		WriteBlocksWithJournal(changed_blocks , journal);
+	}else{
+		WriteBlocks(changed_blocks);
+	}
+}
+
+/* The maximum number of bytes written by a single call when contiguous blocks are merged. */
+#define MAX_MERGED_WRITE_SIZE (1024U * 1024U)
+
+bool DeviceBlockPointerOffsetCompare(const DeviceBlock *a , const DeviceBlock *b){
+	return a->offset < b->offset;
+}
+
+void FATDevice::WriteBlocks(const vector<DeviceBlock> &blocks){
+	vector<const DeviceBlock*> sorted_blocks , allocation_blocks , directory_blocks , release_blocks;
+	vector<DeviceBlock> allocations(blocks.size());
+	/* The FATs are contiguous. The reserved sectors (with the FSInfo sector) are before them. */
+	uint64 fats_start = uint64(fats_first_sector[0]) * uint64(bs_bpb.BPB_BytsPerSec);
+	uint64 fats_end = uint64(fats_first_sector.back() + fat_size) * uint64(bs_bpb.BPB_BytsPerSec);
+	uint32 i;
+
+	if(durability_policy != DURABILITY_ORDERED){
+		for(i = 0 ; i < blocks.size() ; i++)
+			sorted_blocks.push_back(&blocks[i]);
+		WriteSortedBlocks(sorted_blocks);
+		return;
+	}
+	/* A cluster is marked used in the FAT before a directory points to it and marked
+		free only after no directory points to it anymore, so after a crash the FAT never
+		has a cluster in use marked as free. The other FAT changes, like the end of a
+		truncated chain, and the FSInfo sector are written with the frees. */
+	for(i = 0 ; i < blocks.size() ; i++){
+		if(blocks[i].offset >= fats_end){
+			directory_blocks.push_back(&blocks[i]);
+			continue;
+		}
+		if(blocks[i].offset >= fats_start && GetAllocationBlock(blocks[i] , allocations[i]))
+			allocation_blocks.push_back(&allocations[i]);
+		release_blocks.push_back(&blocks[i]);
+	}
+	if(!allocation_blocks.empty()){
+		WriteSortedBlocks(allocation_blocks);
+		Barrier();
+	}
+	if(!directory_blocks.empty()){
+		WriteSortedBlocks(directory_blocks);
+		Barrier();
+	}
+	if(!release_blocks.empty()){
+		WriteSortedBlocks(release_blocks);
+		Barrier();
+	}
+}
+
+bool FATDevice::GetAllocationBlock(const DeviceBlock &block , DeviceBlock &allocation_block){
+	uint32 entry_size = fat_type == FAT16 ? 2 : 4 , mask = fat_type == FAT16 ? 0xFFFF : 0x0FFFFFFF ,
+		original_entry , entry;
+	bool has_allocations = false;
+
+	allocation_block.offset = block.offset;
+	allocation_block.data.resize(block.data.size());
+	device_file->Read(allocation_block.data.data() , (uint32)allocation_block.data.size() , block.offset);
+	for(uint32 i = 0 ; i + entry_size <= block.data.size() ; i += entry_size){
+		original_entry = entry = 0;
+		memcpy(&original_entry , allocation_block.data.data() + i , entry_size);
+		memcpy(&entry , block.data.data() + i , entry_size);
+		if((original_entry & mask) == 0 && (entry & mask) != 0){
+			memcpy(allocation_block.data.data() + i , block.data.data() + i , entry_size);
+			has_allocations = true;
+		}
+	}
+	return has_allocations;
+}
+
+void FATDevice::Barrier(){
+	if(durability_policy == DURABILITY_ORDERED) device_file->Sync();
+}
+
+void FATDevice::WriteSortedBlocks(vector<const DeviceBlock*> &sorted_blocks){
+	AlignedBufferPool::Buffer buffer(buffer_pool , MAX_MERGED_WRITE_SIZE);
+	uint64 buffer_offset = 0;
+	uint32 i , buffer_size = 0;
+
+	stable_sort(sorted_blocks.begin() , sorted_blocks.end() , DeviceBlockPointerOffsetCompare);
+	if(erase_block_size != 0){
+		WriteEraseBlocks(sorted_blocks);
+		return;
+	}
+
+	for(i = 0 ; i < sorted_blocks.size() ; i++){
+		const DeviceBlock *block = sorted_blocks[i];
+		if(buffer_size > 0 && (buffer_offset + buffer_size != block->offset ||
+			buffer_size + block->data.size() > MAX_MERGED_WRITE_SIZE)){
+			device_file->Write(buffer.get() , buffer_size , buffer_offset);
+			buffer_size = 0;
+		}
+		/* A block larger than the buffer is written alone. */
+		if(block->data.size() > MAX_MERGED_WRITE_SIZE){
+			device_file->Write(block->data.data() , (uint32)block->data.size() , block->offset);
+			continue;
+		}
+		if(buffer_size == 0) buffer_offset = block->offset;
+		memcpy(buffer.get() + buffer_size , block->data.data() , block->data.size());
+		buffer_size += (uint32)block->data.size();
+	}
+	if(buffer_size > 0)
+		device_file->Write(buffer.get() , buffer_size , buffer_offset);
+}
+
+void FATDevice::WriteEraseBlocks(const vector<const DeviceBlock*> &sorted_blocks){
+	AlignedBufferPool::Buffer buffer(buffer_pool , erase_block_size);
+	uint64 group_start , group_end , erase_block_start_offset , erase_block_end_offset ,
+		last_erase_block_start_offset = 0;
+	uint32 i , j , touched_erase_blocks = 0;
+	bool contiguous;
+
+	for(i = 0 ; i < sorted_blocks.size() ; i = j){
+		group_start = sorted_blocks[i]->offset;
+		group_end = group_start + sorted_blocks[i]->data.size();
+		GetEraseBlock(group_start , erase_block_start_offset , erase_block_end_offset);
+		if(touched_erase_blocks == 0 || erase_block_start_offset != last_erase_block_start_offset)
+			touched_erase_blocks++;
+		last_erase_block_start_offset = erase_block_start_offset;
+
+		/* A block that crosses the end of the erase block is written alone. */
+		if(group_end > erase_block_end_offset){
+			device_file->Write(sorted_blocks[i]->data.data() , (uint32)sorted_blocks[i]->data.size() ,
+				group_start);
+			j = i + 1;
+			continue;
+		}
+		contiguous = true;
+		for(j = i + 1 ; j < sorted_blocks.size() ; j++){
+			uint64 block_end = sorted_blocks[j]->offset + sorted_blocks[j]->data.size();
+			if(block_end > erase_block_end_offset) break;
+			contiguous = contiguous && sorted_blocks[j]->offset == group_end;
+			group_end = max(group_end , block_end);
+		}
+
+		/* The gaps between the blocks are written with the content they already have. */
+		if(!contiguous)
+			device_file->Read(buffer.get() , uint32(group_end - group_start) , group_start);
+		for(uint32 k = i ; k < j ; k++){
+			memcpy(buffer.get() + (sorted_blocks[k]->offset - group_start) , sorted_blocks[k]->data.data() ,
+				sorted_blocks[k]->data.size());
+		}
+		device_file->Write(buffer.get() , uint32(group_end - group_start) , group_start);
+	}
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << sorted_blocks.size() << " blocks were written to " << touched_erase_blocks <<
+			" erase blocks." << endl;
+	}
+}
+
+void FATDevice::GetEraseBlock(uint64 offset , uint64 &start_offset , uint64 &end_offset){
+	/* The device may start in the middle of an erase block. */
+	if(offset < erase_block_start){
+		start_offset = 0;
+		end_offset = erase_block_start;
+	}else{
+		start_offset = offset - (offset - erase_block_start) % erase_block_size;
+		end_offset = start_offset + erase_block_size;
+	}
+}
+
+void FATDevice::AddEraseBlockGaps(const vector<DeviceBlock> &blocks , Journal *journal){
+	vector<const DeviceBlock*> sorted_blocks;
+	vector<uint8> data;
+	uint64 start_offset , end_offset , previous_start_offset = 0 , previous_end = 0 , block_end;
+	bool has_previous = false;
+	uint32 i;
+
+	for(i = 0 ; i < blocks.size() ; i++)
+		sorted_blocks.push_back(&blocks[i]);
+	stable_sort(sorted_blocks.begin() , sorted_blocks.end() , DeviceBlockPointerOffsetCompare);
+	/* WriteEraseBlocks only rewrites the gaps between blocks inside the same erase block,
+		also when it writes a part of the blocks, so these gaps cover everything it may
+		rewrite. A block that crosses the end of its erase block is written alone. */
+	for(i = 0 ; i < sorted_blocks.size() ; i++){
+		block_end = sorted_blocks[i]->offset + sorted_blocks[i]->data.size();
+		GetEraseBlock(sorted_blocks[i]->offset , start_offset , end_offset);
+		if(block_end > end_offset){
+			has_previous = false;
+			continue;
+		}
+		if(has_previous && start_offset == previous_start_offset && sorted_blocks[i]->offset > previous_end){
+			data.resize(size_t(sorted_blocks[i]->offset - previous_end));
+			device_file->Read(data.data() , (uint32)data.size() , previous_end);
+			journal->AddBlock(previous_end , data.data() , (uint32)data.size());
+		}
+		if(!has_previous || start_offset != previous_start_offset || block_end > previous_end)
+			previous_end = block_end;
+		previous_start_offset = start_offset;
+		has_previous = true;
+	}
+}
+
+void FATDevice::RollBack(const Journal &journal){
+	const vector<DeviceBlock> &blocks = journal.GetBlocks();
+	uint64 device_size = uint64(total_sectors) * uint64(bs_bpb.BPB_BytsPerSec);
+
+	if(journal.GetVolumeID() != GetVolumeID())
+		throw FATDeviceException("The journal was not created for this device.");
+	for(uint32 i = 0 ; i < blocks.size() ; i++){
+		if(blocks[i].offset + blocks[i].data.size() > device_size)
+			throw FATDeviceException("The journal has a block outside the device.");
+	}
+	WriteBlocks(blocks);
 }
 
 FATDevice::operator string(){
@@ -608,6 +1688,10 @@ FATDevice::operator string(){
 
 	buffer << "The first data sector is " << first_data_sector << " (0x" << hex <<
 		first_data_sector << dec <<	")." << endl;
+	if(partition_size != 0){
+		buffer << "The partition starts at byte offset " << device_file->GetBaseOffset() << " (0x" << hex <<
+			device_file->GetBaseOffset() << dec << ") and has " << partition_size << " bytes." << endl;
+	}
 	return buffer.str();
 }
 
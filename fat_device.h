@@ -24,23 +24,104 @@
 #ifndef YAFS_FAT_DEVICE_H
 	#define YAFS_FAT_DEVICE_H
 
+	#include "aligned_buffer_pool.h"
+	#include "device_block.h"
+	#include "device_probe.h"
 	#include "exception.h"
 	#include "fat.h"
 	#include "fat_device_type.h"
 	#include "fat_elements.h"
+	#include "file_allocation_table.h"
 	#include "file_io.h"
+	#include "journal.h"
+	#include "tree_snapshot.h"
 	#include "types.h"
+	#include "write_plan.h"
 
+	#include <chrono>
+	#include <mutex>
 	#include <vector>
 	#include <string>
 	using namespace std;
 
 	class FATDevice {
 		public:
-			FATDevice(const char* path, const char *access_mode);
+			/* If direct_io is true, the device is read and written bypassing the system
+				cache. Block devices always use direct I/O on Linux. If the device has a MBR
+				or a GPT, the partition is given as "path:N" or, without it, the only FAT
+				partition is used. */
+			FATDevice(const char* path, const char *access_mode , bool direct_io = false);
 			~FATDevice();
+			/* If a snapshot cache directory was set, the directories whose clusters did
+				not change since the last read are restored from the snapshot of the volume
+				instead of being parsed again. */
 			RootDirectory* ReadDirectoriesTree();
-			void WriteDirectoriesTree(RootDirectory* );
+			void SetSnapshotCacheDirectory(const string &snapshot_cache_directory);
+			/* With a queue depth greater than zero, the directories are read by a single
+				thread event loop instead of recursively. Up to queue depth directories are
+				read at once, each one suspended while it waits for its next cluster. */
+			void SetScanQueueDepth(uint32 scan_queue_depth);
+			/* Chooses the queue depth, the read size and the buffer alignment from the
+				characteristics of the device. The result is cached in the snapshot cache
+				directory, so it must be set before. */
+			DeviceTuning AutoTune();
+			/* If a path like "/MUSIC/ROCK" is set, only the directories inside it are read
+				and written. The directories on the path are resolved using their short or
+				long names. */
+			void SetSubtreePath(const string &subtree_path);
+			/* If set, the deleted entries are not written again and each directory is
+				rewritten into the minimum number of clusters. The clusters left are freed in
+				every FAT. The FAT16 root directory is not changed as its size is fixed. */
+			void SetCompactDirectories(bool compact_directories);
+			/* If set, each directory whose clusters are not contiguous is moved to the
+				first free clusters that are before it is written, so it can be read with one
+				sequential read. The FAT32 root directory and the subtree directory are not
+				moved. It can't be used when the directories are written one at a time. */
+			void SetDefragmentDirectories(bool defragment_directories);
+			/* If set, WriteDirectoriesTree copies the clusters of the files to contiguous
+				free clusters in the order of the tree before the directories are written,
+				so the files are stored one after another in ascending cluster order. The
+				files that are already in place are not copied. */
+			void SetRelocateFiles(bool relocate_files);
+			/* If a journal is given, only the blocks that change are written and their
+				original content is saved in the journal before. */
+			void WriteDirectoriesTree(RootDirectory* , Journal *journal = NULL);
+			/* Reads only the entries of the root directory (or of the subtree directory).
+				The subdirectories are left empty. */
+			RootDirectory* ReadRootDirectory();
+			/* Reads only the entries of an empty directory of the tree. */
+			void ReadDirectoryContent(FATDirectory*);
+			/* Writes only the entries of the directory, not of its subdirectories. */
+			void WriteDirectoryContent(FATDirectory*);
+			void WriteRootDirectoryContent(RootDirectory*);
+			/* Builds the blocks of only the entries of the directory, not of its
+				subdirectories, without writing them. */
+			void SerializeDirectoryContent(FATDirectory* , vector<DeviceBlock> &blocks);
+			/* Appends the blocks of the FAT changes made while the blocks were built and
+				writes all of them. */
+			void WriteSerializedBlocks(vector<DeviceBlock> &blocks);
+			/* Builds the blocks that WriteDirectoriesTree writes without writing them. If
+				recursive is false, only the blocks of the root directory are built. */
+			void SerializeDirectoriesTree(RootDirectory* , vector<DeviceBlock> &blocks ,
+				bool recursive = true);
+			/* Writes the blocks in ascending offset order merging the contiguous ones.
+				With DURABILITY_ORDERED, the clusters allocated in the FAT, the directories
+				and then the rest of the FAT are written, each one flushed before the next. */
+			void WriteBlocks(const vector<DeviceBlock> &blocks);
+			/* Stores the blocks that WriteDirectoriesTree would change in a plan. If
+				only_changed_blocks is false, the blocks that will not change are also
+				stored, so all the directories are verified when the plan is applied. */
+			void CreateWritePlan(RootDirectory* , WritePlan &write_plan , bool only_changed_blocks = true);
+			/* Checks that the device still has the content the plan was created for
+				and then writes it. */
+			void ApplyWritePlan(const WritePlan &write_plan , Journal *journal = NULL);
+			/* The checksum of the boot sector and of the first FAT. */
+			uint32 ComputeMetadataChecksum();
+			/* Restores the original content of the blocks saved in the journal. */
+			void RollBack(const Journal &journal);
+			uint32 GetVolumeID(){
+				return bs_fat.BS_VolID;
+			}
 
 			operator string();
 
@@ -55,8 +136,53 @@
 				FAT32 = 2
 			};
 
+			enum PackingPolicy {
+				PACK_NONE = 0,
+				PACK_CLUSTERS = 1,
+				PACK_SECTORS = 2
+			};
+
+			/* If a policy other than PACK_NONE is set, deleted entries are written before
+				the entries of an element that would be split between two clusters (or
+				sectors), as long as the directory has enough free entries. */
+			void SetPackingPolicy(PackingPolicy packing_policy);
+
+			enum DurabilityPolicy {
+				DURABILITY_NONE = 0,
+				DURABILITY_END = 1,
+				DURABILITY_ORDERED = 2
+			};
+
+			/* With DURABILITY_NONE, the device is never flushed, which is enough for an
+				image that is copied afterwards. With DURABILITY_END, it is flushed when it
+				is closed, after the moved file clusters and before a journal is committed.
+				With DURABILITY_ORDERED, the moved file clusters, the clusters allocated in the
+				FAT, the directories and the rest of the FAT are each flushed before the next
+				one is written. */
+			void SetDurabilityPolicy(DurabilityPolicy durability_policy);
+
+			/* The erase block size that SetEraseBlockSize gets from the device. */
+			const static uint32 PROBE_ERASE_BLOCK_SIZE;
+			/* The size used when the device does not report its erase block. */
+			const static uint32 DEFAULT_ERASE_BLOCK_SIZE;
+
+			/* If it is not zero, the blocks written that are inside the same erase block
+				of a flash card are written with a single write, filling the gaps with the
+				device content, so the card erases each block only once. */
+			void SetEraseBlockSize(uint32 erase_block_size);
+
 		private:
+			/* A directory being read by ScanDirectories. It is suspended while its next
+				cluster is not read. */
+			struct DirectoryScan {
+				FATDirectory *fat_directory;
+				uint32 next_cluster , read_clusters;
+				vector<uint8> data;
+			};
+
 			FileIO *device_file;
+			/* The buffers used to read and write the device are aligned to its blocks. */
+			AlignedBufferPool *buffer_pool;
 			BootSectorBIOSParameterBlock bs_bpb;
 			BIOSParameterBlockFAT32 *bpb_fat32;
 			BootSectorFAT bs_fat;
@@ -65,6 +191,26 @@
 			vector<uint32> fats_first_sector;
 			FATType fat_type;
 			uint8 *fat_buffer;
+			/* The FAT sector in fat_buffer is shared by the threads that read the device. */
+			std::mutex fat_buffer_mutex;
+			string snapshot_cache_directory , subtree_path;
+			uint32 scan_queue_depth , merged_read_size;
+			bool compact_directories , defragment_directories , relocate_files;
+			/* The changes made to the FAT while the directories are serialized. */
+			FileAllocationTable *file_allocation_table;
+			uint32 freed_clusters , allocated_clusters , relocated_directories , relocated_files;
+			PackingPolicy packing_policy;
+			DurabilityPolicy durability_policy;
+			/* The erase blocks start at erase_block_start on the device. */
+			uint32 erase_block_size , erase_block_start;
+			/* The size of the partition used or zero if the device has no partitions. */
+			uint64 partition_size;
+			/* The elements split between two packing units without and with the policy. */
+			uint32 unpacked_split_elements , split_elements;
+			/* The cluster where the search for free clusters starts. */
+			uint32 free_cluster_search;
+			/* The directory of the subtree read or NULL if the whole tree was read. */
+			FATDirectory *subtree_directory;
 
 			static uint32 file_last_cluster[];
 
@@ -72,8 +218,92 @@
 				cluster = cluster & 0x0FFFFFFF;
 				return cluster >= file_last_cluster[(uint32)fat_type] || cluster == 0;
 			}
-			void ReadDirectory(FATDirectory*);
-			void WriteDirectory(FATDirectory*);
+			/* Reads the clusters of a directory up to the one with the end entry. The
+				root directory is read if fat_directory is NULL. */
+			void ReadDirectoryData(FATDirectory* fat_directory , vector<uint8> &data);
+			/* Inserts the elements of the directory data without reading the subdirectories. */
+			void ParseDirectoryData(const vector<uint8> &data , FATDirectory* , RootDirectory*);
+			/* If snapshots are given, the directory is restored from the previous one when
+				its clusters did not change and it is stored in the next. */
+			void LoadDirectory(const vector<uint8> &data , FATDirectory* , RootDirectory* ,
+				TreeSnapshot *previous_snapshot , TreeSnapshot *next_snapshot);
+			/* Calls ReadDirectory or ScanDirectories according to the scan queue depth. */
+			void ReadDirectories(FATDirectory* , RootDirectory* , TreeSnapshot *previous_snapshot ,
+				TreeSnapshot *next_snapshot);
+			/* Reads the directory and its subdirectories recursively. The data is reused by
+				all of them. */
+			void ReadDirectory(FATDirectory* , RootDirectory* , TreeSnapshot *previous_snapshot ,
+				TreeSnapshot *next_snapshot , vector<uint8> &data);
+			/* Reads the subdirectories with the event loop. */
+			void ScanDirectories(FATDirectory* , RootDirectory* , TreeSnapshot *previous_snapshot ,
+				TreeSnapshot *next_snapshot);
+			void MoveSubtreeContent(RootDirectory*);
+			/* Logs how long the operation took and how many buffers of the pool it reused. */
+			void LogOperationStatistics(const string &operation ,
+				const std::chrono::steady_clock::time_point &start);
+			/* Returns NULL if the subtree path is the root directory. */
+			FATDirectory* FindSubtreeDirectory();
+			/* The volume identity and the checksum of the boot sector. */
+			TreeSnapshotKey ComputeSnapshotKey();
+			string GetSnapshotPath();
+			void SerializeDirectory(FATDirectory* , vector<DeviceBlock> &blocks , bool recursive = true);
+			/* Fills the directory clusters after the last entry. With compaction, the
+				clusters not needed are removed from the chain. previous_cluster is 0 if
+				current_cluster is the first cluster of the directory. */
+			void SerializeDirectoryTail(GenericEntry *ge , uint32 i , uint32 current_cluster ,
+				uint32 previous_cluster , vector<DeviceBlock> &blocks);
+			void FreeClusterChain(uint32 cluster);
+			/* Returns how many deleted entries must be written before an element with
+				size entries at position so it is not split between two units of unit_size
+				entries. free_entries is decreased by them. unpacked_position is the position
+				the element would have without the policy. */
+			uint32 GetPaddingEntries(uint32 position , uint32 &unpacked_position , uint32 size ,
+				uint32 unit_size , uint32 &free_entries);
+			/* The number of entries of the clusters of the chain. */
+			uint32 GetChainEntries(uint32 first_cluster);
+			/* Moves the fragmented subdirectories of the content and of its subdirectories.
+				Only the FAT and the entries that point to them are changed. The directory
+				clusters are filled when they are serialized. */
+			void RelocateDirectories(const vector<FATElement*> &content);
+			/* Returns false if there were not enough contiguous free clusters. */
+			bool RelocateDirectory(FATDirectory*);
+			/* Copies the files of the content and of its subdirectories in order. Returns
+				false when there are no more free clusters after the last file copied. */
+			bool RelocateFiles(const vector<FATElement*> &content);
+			/* Copies the file clusters to the new contiguous clusters using a buffer of
+				MAX_MERGED_READ_SIZE bytes. */
+			void CopyFileData(uint32 first_cluster , uint32 new_first_cluster , uint32 chain_size);
+			/* Returns the first of count contiguous clusters free on the device and in the FAT
+				changes or 0 if there are not. */
+			uint32 FindFreeClusters(uint32 count);
+			static void SetFirstCluster(DirectoryEntryStructure &de , uint32 cluster){
+				de.DIR_FstClusHI = (uint16)(cluster >> 16);
+				de.DIR_FstClusLO = (uint16)(cluster & 0xFFFF);
+			}
+			/* Appends the FAT sectors changed and, on FAT32, the FSInfo sector with the
+				new free cluster count. */
+			void SerializeAllocationChanges(vector<DeviceBlock> &blocks);
+			void AppendBlock(vector<DeviceBlock> &blocks , const uint8 *buffer , uint32 size , uint64 offset);
+			/* Removes the blocks equal to the device content and returns the original
+				content of the remaining ones. */
+			void SelectChangedBlocks(vector<DeviceBlock> &blocks , vector<DeviceBlock> &original_blocks);
+			void WriteBlocksWithJournal(const vector<DeviceBlock> &blocks , Journal *journal);
+			/* Sorts the blocks and writes them merging the contiguous ones. */
+			void WriteSortedBlocks(vector<const DeviceBlock*> &sorted_blocks);
+			/* Writes the sorted blocks that are inside the same erase block with a single
+				write. */
+			void WriteEraseBlocks(const vector<const DeviceBlock*> &sorted_blocks);
+			/* Gets the erase block where the offset is. */
+			void GetEraseBlock(uint64 offset , uint64 &start_offset , uint64 &end_offset);
+			/* Saves in the journal the content of the gaps that WriteEraseBlocks rewrites
+				between the blocks, so a write stopped in the middle of an erase block can be
+				rolled back. */
+			void AddEraseBlockGaps(const vector<DeviceBlock> &blocks , Journal *journal);
+			/* With DURABILITY_ORDERED, waits until everything written reached the device. */
+			void Barrier();
+			/* Builds the content the FAT block has on the device with only the entries that
+				change from free to used set as in the block. Returns false if there are none. */
+			bool GetAllocationBlock(const DeviceBlock &block , DeviceBlock &allocation_block);
 			uint64 GetClusterOffset(uint32 cluster);
 			void ReadSector(void* buffer , uint32 sector);
 			void ReadCluster(void* buffer , uint32 cluster);
@@ -82,6 +312,11 @@
 			uint32 ReadFAT(uint32 cluster);
 
 			friend ostream &operator<<(ostream &stream , FATDevice &fat_device);
+			/* Reads the partition table and makes the device offsets start at the
+				partition. */
+			void SelectPartition(uint32 partition_number);
+			/* Used by the destructor and by the constructor when it throws. */
+			void ReleaseResources();
 			void ThrowNotFATFileSystemException(){
 				throw FATDeviceException("The device does not have a FAT file system.");
 			}
@@ -25,9 +25,12 @@
 #include "xercesc.h"
 
 #include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 
 /* Xerces includes: */
 #include <xercesc/dom/DOMException.hpp>
@@ -87,6 +90,21 @@ FATElement* FATElementFactory::CreateFATElement(const DirectoryEntryStructure *d
 	}
 }
 
+FATElement* FATElementFactory::CreateFATElement(const vector<GenericEntry> &directory_entries ,
+	const uint8 *short_name , const uint8 *long_name){
+	const DirectoryEntryStructure *de = &directory_entries.back().de;
+
+	if(!(de->DIR_Attr & (ATTR_DIRECTORY | ATTR_VOLUME_ID))){
+		return new FATFile(directory_entries , short_name , long_name);
+	}else if((de->DIR_Attr & (ATTR_DIRECTORY | ATTR_VOLUME_ID)) == ATTR_DIRECTORY){
+		return new FATDirectory(directory_entries , short_name , long_name);
+   }else if((de->DIR_Attr & (ATTR_DIRECTORY | ATTR_VOLUME_ID)) == ATTR_VOLUME_ID){
+		return new FATFile(directory_entries , short_name , long_name);
+	}else{
+		throw InvalidFATElementException("The file system has an invalid entry.");
+	}
+}
+
 /* FATElement. */
 // TODO: Move to static method on class FATElement?
 bool FATElementCompare(FATElement* a , FATElement* b){
@@ -181,35 +199,94 @@ FATElement::FATElement(const DirectoryEntryStructure *de ,
 	}
 	ge.de = *de;
 	directory_entries.push_back(ge);
-	short_name = GetShortName(de);
+	GetShortName(de , short_name);
 	order = 0;
 	reordered = false;
 	attributes = de->DIR_Attr;
 }
 
-uint8* FATElement::GetShortName(const DirectoryEntryStructure *de){
-	uint32 i = 0;
-	uint8 *final_short_name;
-	vector<uint8> short_name_byte , short_name_utf8;
-	bool has_extension = false;
+FATElement::FATElement(const vector<GenericEntry> &directory_entries ,
+	const uint8 *short_name , const uint8 *long_name){
+	size_t length = strlen((const char*)short_name);
+
+	assert(length < SHORT_NAME_BUFFER_SIZE);
+	memcpy(this->short_name , short_name , length + 1);
+	if(long_name != NULL){
+		length = strlen((const char*)long_name);
+		this->long_name = new uint8[length + 1];
+		memcpy(this->long_name , long_name , length + 1);
+	}else{
+		this->long_name = NULL;
+	}
+	this->directory_entries = directory_entries;
+	order = 0;
+	reordered = false;
+	attributes = directory_entries.back().de.DIR_Attr;
+}
+
+void FATElement::GetShortName(const DirectoryEntryStructure *de , uint8 *short_name){
+	uint8 short_name_byte[12];
+	uint32 i = 0 , length = 0;
 
 	while(i < 8 && de->DIR_Name[i] != ' ')
-		short_name_byte.push_back(de->DIR_Name[i++]);
+		short_name_byte[length++] = de->DIR_Name[i++];
 
-	short_name_byte.push_back('.');
 	i = 8;
-	while(i < 11 && de->DIR_Name[i] != ' '){
-		short_name_byte.push_back(de->DIR_Name[i++]);
-		has_extension = true;
+	if(de->DIR_Name[i] != ' '){
+		short_name_byte[length++] = '.';
+		while(i < 11 && de->DIR_Name[i] != ' ')
+			short_name_byte[length++] = de->DIR_Name[i++];
+	}
+
+	Unicode::ConvertFromCodePageToUTF8(short_name_byte , length , short_name);
+}
+
+/* Directories with fewer elements than this are sorted by comparisons. */
+#define RADIX_SORT_MIN_ELEMENTS 256
+
+struct OrderIndex {
+	uint32 order;
+	uint32 index;
+};
+
+/* The sort is stable: elements with the same order keep their relative position. */
+void FATElement::SortByOrder(vector<FATElement*> &fat_elements){
+	uint32 i , shift , n = (uint32)fat_elements.size();
+
+	if(n < RADIX_SORT_MIN_ELEMENTS){
+		stable_sort(fat_elements.begin() , fat_elements.end() , FATElementCompare);
+		return;
+	}
+
+	/* The keys are copied to a contiguous array and sorted with a LSD radix sort
+		of 8 bits digits. Only the permutation is applied to the elements. */
+	vector<OrderIndex> keys(n) , auxiliary(n);
+	for(i = 0 ; i < n ; i++){
+		keys[i].order = fat_elements[i]->order;
+		keys[i].index = i;
+	}
+
+	for(shift = 0 ; shift < 32 ; shift += 8){
+		uint32 count[256] = {0} , position = 0 , aux;
+
+		for(i = 0 ; i < n ; i++)
+			count[(keys[i].order >> shift) & 0xFF]++;
+		/* All keys have the same digit so this pass would not change anything. */
+		if(count[(keys[0].order >> shift) & 0xFF] == n) continue;
+		for(i = 0 ; i < 256 ; i++){
+			aux = count[i];
+			count[i] = position;
+			position += aux;
+		}
+		for(i = 0 ; i < n ; i++)
+			auxiliary[count[(keys[i].order >> shift) & 0xFF]++] = keys[i];
+		keys.swap(auxiliary);
 	}
-	if(!has_extension) short_name_byte.pop_back();
 
-	short_name_utf8 = Unicode::ConvertFromByteToUTF8(short_name_byte);
-	final_short_name = new uint8[short_name_utf8.size() + 1];
-	for(i = 0 ; i < short_name_utf8.size() ; i++)
-		final_short_name[i] = short_name_utf8[i];
-	final_short_name[i] = '\0';
-	return final_short_name;
+	vector<FATElement*> sorted(n);
+	for(i = 0 ; i < n ; i++)
+		sorted[i] = fat_elements[keys[i].index];
+	fat_elements.swap(sorted);
 }
 
 /* FATFile. */
@@ -232,7 +309,7 @@ string FATFile::ToXML(uint32 n_tabs){
 }
 
 /* FATDirectory. */
-void ThrowDoNotMatchException(string message = string("")){
+void ThrowDoNotMatchException(string message){
 	throw RootDirectory::RootDirectoryException(
 		string("The device file system do not match with the "
 			"file system in input file.").append(message));
@@ -264,24 +341,37 @@ string FATDirectory::ToXML(uint32 n_tabs){
 void FATDirectory::InsertFATElement(FATElement *fat_element){
 	fat_element->order = (uint32) (content.size() + 1) * 100;
 	content.push_back(fat_element);
-	content_map.insert(make_pair((const char*)fat_element->short_name , fat_element));
+	content_index.Insert(fat_element->directory_entries.back().de.DIR_Name , fat_element);
 }
 
+/* The subtrees are grouped in tasks of at least this number of elements. A tree with
+	fewer elements is sorted without starting any thread. */
+#define PARALLEL_SORT_MIN_TASK_ELEMENTS 4096
+
 void FATDirectory::Sort(){
-	sort(content.begin() , content.end() , FATElementCompare);
+	FATElement::SortByOrder(content);
 	for(uint32 i = 0 ; i < content.size() ; i++)
 		if(content[i]->IsDirectory()) ((FATDirectory*)content[i])->Sort();
 }
 
-bool FATDirectory::ReorderFATElement(uint8* short_name , uint32 order , FATElement** fat_element){
-	map<const char* , FATElement* , StringCompare>::iterator i;
+uint32 FATDirectory::GetNumberOfElements(){
+	uint32 number_of_elements = (uint32)content.size();
 
-	i = content_map.find((char*)short_name);
-	if(i == content_map.end() || i->second->reordered)
+	for(uint32 i = 0 ; i < content.size() ; i++){
+		if(content[i]->IsDirectory())
+			number_of_elements += ((FATDirectory*)content[i])->GetNumberOfElements();
+	}
+	return number_of_elements;
+}
+
+bool FATDirectory::ReorderFATElement(const uint8* dir_name , uint32 order , FATElement** fat_element){
+	FATElement *found = content_index.Find(dir_name);
+
+	if(found == NULL || found->reordered)
 		return false;
-	i->second->reordered = true;
-	i->second->order = order;
-	*fat_element = i->second;
+	found->reordered = true;
+	found->order = order;
+	*fat_element = found;
 	return true;
 }
 
@@ -395,10 +485,10 @@ RootDirectory::~RootDirectory(){
 void RootDirectory::InsertFATElement(FATElement *fat_element){
 	fat_element->order = (uint32) (content.size() + 1) * 100;
 	content.push_back(fat_element);
-	content_map.insert(make_pair((const char*)fat_element->short_name , fat_element));
+	content_index.Insert(fat_element->directory_entries.back().de.DIR_Name , fat_element);
 }
 
-uint8* ExtractShortName(DOMElement* element){
+const XMLCh* ExtractShortName(DOMElement* element){
 	DOMNodeList *children = element->getChildNodes();
 	DOMNode *short_name_element;
 
@@ -410,21 +500,50 @@ uint8* ExtractShortName(DOMElement* element){
 			/* It must have only one child. */
 			if(children->getLength() != 1 ||
 				children->item(0)->getNodeType() != DOMNode::TEXT_NODE) continue;
-				return Xercesc::TranscodeToUTF8(children->item(0)->getNodeValue());
+				return children->item(0)->getNodeValue();
 		}
 	}
 	return NULL;
 }
 
-bool RootDirectory::ReorderFATElement(uint8* short_name , uint32 order , FATElement** fat_element){
-	map<const char* , FATElement* , StringCompare>::iterator i;
+bool ConvertShortNameToDIRName(const XMLCh *short_name , uint8 *dir_name){
+	uint8 short_name_byte[12];
+	uint32 i , length , name_length , extension_start;
+
+	if(!Unicode::ConvertFromUTF16ToCodePage((const uint16*)short_name , short_name_byte ,
+		sizeof(short_name_byte) , length)) return false;
+
+	name_length = extension_start = length;
+	for(i = 0 ; i < length ; i++){
+		if(short_name_byte[i] == '.'){
+			name_length = i;
+			extension_start = i + 1;
+		}
+	}
+	if(name_length > 8 || length - extension_start > 3) return false;
 
-	i = content_map.find((char* )short_name);
-	if(i == content_map.end() || i->second->reordered)
+	memset(dir_name , ' ' , 11);
+	memcpy(dir_name , short_name_byte , name_length);
+	memcpy(dir_name + 8 , short_name_byte + extension_start , length - extension_start);
+	return true;
+}
+
+void ThrowDoNotMatchException(const XMLCh *short_name){
+	uint8 *short_name_utf8 = Xercesc::TranscodeToUTF8(short_name);
+	string short_name_str((char*)short_name_utf8);
+
+	delete[] short_name_utf8;
+	ThrowDoNotMatchException(short_name_str);
+}
+
+bool RootDirectory::ReorderFATElement(const uint8* dir_name , uint32 order , FATElement** fat_element){
+	FATElement *found = content_index.Find(dir_name);
+
+	if(found == NULL || found->reordered)
 		return false;
-	i->second->reordered = true;
-	i->second->order = order;
-	*fat_element = i->second;
+	found->reordered = true;
+	found->order = order;
+	*fat_element = found;
 	return true;
 }
 
@@ -432,7 +551,8 @@ void FATDirectory::ReorderFATDirectory(DOMElement* directory_element){
 	DOMNode *child;
 	DOMNodeList *children;
 	uint32 children_reordered = 0 , order;
-	uint8 *short_name;
+	const XMLCh *short_name;
+	uint8 dir_name[11];
 	bool is_directory = false;
 	FATElement *fat_element;
 
@@ -447,11 +567,9 @@ void FATDirectory::ReorderFATDirectory(DOMElement* directory_element){
 			XMLString::textToBin(((DOMElement*)child)->getAttribute(order_utf16_str) , order);
 			short_name = ExtractShortName((DOMElement*)child);
 			if(!short_name) ThrowDoNotMatchException();
-			if(!ReorderFATElement(short_name , order , &fat_element)){
-				string short_name_str((char*)short_name);
-				delete[] short_name;
-				ThrowDoNotMatchException(short_name_str);
-			}
+			if(!ConvertShortNameToDIRName(short_name , dir_name) ||
+				!ReorderFATElement(dir_name , order , &fat_element))
+				ThrowDoNotMatchException(short_name);
 			if(is_directory){
 				if(!fat_element->IsDirectory()) ThrowDoNotMatchException();
 				/* XXX: When an exception is thrown is possible that some memory leaks. */
@@ -459,43 +577,51 @@ void FATDirectory::ReorderFATDirectory(DOMElement* directory_element){
 				((FATDirectory*)fat_element)->ReorderFATDirectory((DOMElement*)child);
 			}
 			children_reordered++;
-			delete[] short_name;
 		}
 	}
 	if(children_reordered != content.size())
 		ThrowDoNotMatchException();
 }
 
+XercesDOMParser* RootDirectory::ParseInputFile(const char* xml_file){
+	std::unique_ptr<XercesDOMParser> parser = std::unique_ptr<XercesDOMParser>(Xercesc::CreateDOMParser(
+		ExecutableDirectoryUtils::GetExecutableDirectoryNativeEncoding() + xsd_file_name));
+	DOMTreeErrorReporter dom_tree_error_reporter;
+
+	parser->setValidationScheme(XercesDOMParser::Val_Always);
+	parser->setDoNamespaces(true);
+	parser->setDoSchema(true);
+	parser->setValidationSchemaFullChecking(true);
+	parser->setValidationConstraintFatal(true);
+	parser->setExternalNoNamespaceSchemaLocation((ExecutableDirectoryUtils::GetExecutableDirectoryNativeEncoding() + xsd_file_name).c_str());
+	parser->setIncludeIgnorableWhitespace(false);
+	parser->setCreateCommentNodes(false);
+
+	parser->setErrorHandler(&dom_tree_error_reporter);
+	parser->parse(xml_file);
+	/* The error reporter does not live longer than this call. */
+	parser->setErrorHandler(NULL);
+	if(dom_tree_error_reporter.SawErrors()){
+		cerr << dom_tree_error_reporter.GetErrors() << endl;
+		throw RootDirectoryException(dom_tree_error_reporter.GetErrors());
+	}
+	return parser.release();
+}
+
 void RootDirectory::ImportNewOrder(const char* xml_file){
 	Xercesc::Initialize();
 
 	try{
-		std::unique_ptr<XercesDOMParser> parser = std::unique_ptr<XercesDOMParser>(new XercesDOMParser());
-		DOMTreeErrorReporter dom_tree_error_reporter;
+		std::unique_ptr<XercesDOMParser> parser = std::unique_ptr<XercesDOMParser>(ParseInputFile(xml_file));
 		DOMElement *root;
 		DOMNode *child;
 		DOMNodeList *children;
 		uint32 children_reordered = 0 , order;
-		uint8 *short_name;
+		const XMLCh *short_name;
+		uint8 dir_name[11];
 		bool is_directory = false;
 		FATElement *fat_element;
 
-		parser->setValidationScheme(XercesDOMParser::Val_Always);
-		parser->setDoNamespaces(true);
-		parser->setDoSchema(true);
-		parser->setValidationSchemaFullChecking(true);
-		parser->setValidationConstraintFatal(true);
-		parser->setExternalNoNamespaceSchemaLocation((ExecutableDirectoryUtils::GetExecutableDirectoryNativeEncoding() + xsd_file_name).c_str());
-		parser->setIncludeIgnorableWhitespace(false);
-		parser->setCreateCommentNodes(false);
-
-		parser->setErrorHandler(&dom_tree_error_reporter);
-		parser->parse(xml_file);
-		if(dom_tree_error_reporter.SawErrors()){
-			cerr << dom_tree_error_reporter.GetErrors() << endl;
-			throw RootDirectoryException(dom_tree_error_reporter.GetErrors());
-		}
-
 		root = parser->getDocument()->getDocumentElement();
 		children = root->getChildNodes();
 		for(uint32 i = 0 ; i < children->getLength() ; i++){
@@ -508,11 +634,9 @@ void RootDirectory::ImportNewOrder(const char* xml_file){
 				XMLString::textToBin(((DOMElement*)child)->getAttribute(order_utf16_str) , order);
 				short_name = ExtractShortName((DOMElement*)child);
 				if(!short_name) ThrowDoNotMatchException();
-				if(!ReorderFATElement(short_name , order , &fat_element)){
-					string short_name_str((char*)short_name);
-					delete[] short_name;
-					ThrowDoNotMatchException(short_name_str);
-				}
+				if(!ConvertShortNameToDIRName(short_name , dir_name) ||
+					!ReorderFATElement(dir_name , order , &fat_element))
+					ThrowDoNotMatchException(short_name);
 				if(is_directory){
 					if(!fat_element->IsDirectory()) ThrowDoNotMatchException();
 					/* XXX: When an exception is thrown is possible that some memory leaks. */
@@ -520,7 +644,6 @@ void RootDirectory::ImportNewOrder(const char* xml_file){
 					((FATDirectory*)fat_element)->ReorderFATDirectory((DOMElement*)child);
 				}
 				children_reordered++;
-				delete[] short_name;
 			}
 		}
 		if(children_reordered != content.size())
@@ -536,13 +659,123 @@ void RootDirectory::ImportNewOrder(const char* xml_file){
 	}catch(RootDirectoryException root_directory_exception){
 		Xercesc::Terminate();
 		throw root_directory_exception;
+	}catch(Xercesc::XercescException xercesc_exception){
+		Xercesc::Terminate();
+		throw xercesc_exception;
 	}
 
 	Xercesc::Terminate();
 }
 
-void RootDirectory::Sort(){
-	sort(content.begin() , content.end() , FATElementCompare);
+/* Used by FATDirectory::ReorderContent and RootDirectory::ReorderContent. The function
+	reorder has the signature of ReorderFATElement. */
+template <class ReorderFunction> void ReorderDirectoryContent(ReorderFunction reorder ,
+	vector<FATElement*> &content , DOMElement* directory_element ,
+	vector<pair<FATDirectory* , DOMElement*> > &subdirectories){
+	DOMNode *child;
+	DOMNodeList *children;
+	uint32 children_reordered = 0 , order;
+	const XMLCh *short_name;
+	uint8 dir_name[11];
+	bool is_directory = false;
+	FATElement *fat_element;
+
+	children = directory_element->getChildNodes();
+	for(uint32 i = 0 ; i < children->getLength() ; i++){
+		child = children->item(i);
+		if(child->getNodeType() != DOMNode::ELEMENT_NODE) continue;
+		is_directory = false;
+		if(XMLString::equals(file_utf16_str , child->getNodeName()) ||
+			(is_directory = XMLString::equals(directory_utf16_str , child->getNodeName()))){
+			/* The Validation guarantees that order attribute will always exist. */
+			XMLString::textToBin(((DOMElement*)child)->getAttribute(order_utf16_str) , order);
+			short_name = ExtractShortName((DOMElement*)child);
+			if(!short_name) ThrowDoNotMatchException();
+			if(!ConvertShortNameToDIRName(short_name , dir_name) ||
+				!reorder(dir_name , order , &fat_element))
+				ThrowDoNotMatchException(short_name);
+			if(is_directory){
+				if(!fat_element->IsDirectory()) ThrowDoNotMatchException();
+				subdirectories.push_back(make_pair((FATDirectory*)fat_element , (DOMElement*)child));
+			}
+			children_reordered++;
+		}
+	}
+	if(children_reordered != content.size())
+		ThrowDoNotMatchException();
+}
+
+void FATDirectory::ReorderContent(DOMElement* directory_element ,
+	vector<pair<FATDirectory* , DOMElement*> > &subdirectories){
+	ReorderDirectoryContent([this](const uint8* dir_name , uint32 order , FATElement** fat_element){
+		return ReorderFATElement(dir_name , order , fat_element);
+	} , content , directory_element , subdirectories);
+	FATElement::SortByOrder(content);
+}
+
+void FATDirectory::GetSubdirectories(vector<FATDirectory*> &subdirectories){
 	for(uint32 i = 0 ; i < content.size() ; i++)
-		if(content[i]->IsDirectory()) ((FATDirectory*)content[i])->Sort();
+		if(content[i]->IsDirectory()) subdirectories.push_back((FATDirectory*)content[i]);
+}
+
+void RootDirectory::ReorderContent(DOMElement* root_element ,
+	vector<pair<FATDirectory* , DOMElement*> > &subdirectories){
+	ReorderDirectoryContent([this](const uint8* dir_name , uint32 order , FATElement** fat_element){
+		return ReorderFATElement(dir_name , order , fat_element);
+	} , content , root_element , subdirectories);
+	FATElement::SortByOrder(content);
+}
+
+void RootDirectory::GetSubdirectories(vector<FATDirectory*> &subdirectories){
+	for(uint32 i = 0 ; i < content.size() ; i++)
+		if(content[i]->IsDirectory()) subdirectories.push_back((FATDirectory*)content[i]);
+}
+
+/* Each subtree is sorted independently, so the result does not depend on how the
+	subtrees are distributed among the threads. */
+void RootDirectory::Sort(){
+	vector<FATDirectory*> subdirectories;
+	vector<vector<FATDirectory*> > tasks(1);
+	uint32 task_elements = 0 , number_of_threads;
+
+	FATElement::SortByOrder(content);
+	GetSubdirectories(subdirectories);
+	/* A tree with a single top directory, as "/MUSIC", is divided below it. */
+	while(subdirectories.size() == 1){
+		FATDirectory *fat_directory = subdirectories[0];
+		FATElement::SortByOrder(fat_directory->content);
+		subdirectories.clear();
+		fat_directory->GetSubdirectories(subdirectories);
+	}
+
+	for(uint32 i = 0 ; i < subdirectories.size() ; i++){
+		if(task_elements >= PARALLEL_SORT_MIN_TASK_ELEMENTS){
+			tasks.push_back(vector<FATDirectory*>());
+			task_elements = 0;
+		}
+		tasks.back().push_back(subdirectories[i]);
+		task_elements += subdirectories[i]->GetNumberOfElements() + 1;
+	}
+	/* The last task may be too small to be worth a thread of its own. */
+	if(tasks.size() > 1 && task_elements < PARALLEL_SORT_MIN_TASK_ELEMENTS){
+		tasks[tasks.size() - 2].insert(tasks[tasks.size() - 2].end() , tasks.back().begin() ,
+			tasks.back().end());
+		tasks.pop_back();
+	}
+
+	number_of_threads = min(max(thread::hardware_concurrency() , 1U) , (uint32)tasks.size());
+	if(number_of_threads == 1){
+		for(uint32 i = 0 ; i < subdirectories.size() ; i++)
+			subdirectories[i]->Sort();
+		return;
+	}
+	ThreadPool thread_pool(number_of_threads);
+	for(uint32 i = 0 ; i < tasks.size() ; i++){
+		const vector<FATDirectory*> &task = tasks[i];
+		thread_pool.Submit([&task](){
+			for(uint32 j = 0 ; j < task.size() ; j++)
+				task[j]->Sort();
+		});
+	}
+	thread_pool.Wait();
 }
@@ -27,16 +27,22 @@
 	#include "fat.h"
 	#include "fat_device_type.h"
 	#include "exception.h"
-	#include "string_compare.h"
+	#include "short_name_index.h"
+	#include "thread_pool.h"
+	#include "unicode.h"
 
-	#include <map>
 	#include <string>
+	#include <utility>
 	#include <vector>
 	/* Xerces includes: */
 	#include <xercesc/dom/DOM.hpp>
+	#include <xercesc/parsers/XercesDOMParser.hpp>
 	using namespace std;
 	XERCES_CPP_NAMESPACE_USE
 
+	/* A short name has at most 12 characters ("NAME8CHR.EXT") plus the terminator. */
+	#define SHORT_NAME_BUFFER_SIZE (12 * CODE_PAGE_CHARACTER_UTF8_MAX_SIZE + 1)
+
 	class InvalidFATElementException : public Exception {
 		public:
 			InvalidFATElementException(string message = ""):Exception(message){}
@@ -46,14 +52,28 @@
 	class FATElementFactory;
 	class FATFile;
 	class RootDirectory;
+	class StreamingSorter;
+
+	/* The schema of the input and output files and the names used in them. */
+	extern const string xsd_file_name;
+	extern const XMLCh file_utf16_str[] , directory_utf16_str[] , order_utf16_str[] ,
+		short_name_utf16_str[];
+
+	/* Converts a short name like "NAME.EXT" back to the 11 bytes used by DIR_Name. */
+	bool ConvertShortNameToDIRName(const XMLCh *short_name , uint8 *dir_name);
+	/* They throw the exception used when the input file does not match the device. */
+	void ThrowDoNotMatchException(string message = string(""));
+	void ThrowDoNotMatchException(const XMLCh *short_name);
 
 	class FATElement {
 		public:
 			FATElement(const DirectoryEntryStructure *de ,
 				const vector<LongDirectoryEntryStructure> lde);
+			/* Creates an element whose names were already decoded. */
+			FATElement(const vector<GenericEntry> &directory_entries ,
+				const uint8 *short_name , const uint8 *long_name);
 			virtual ~FATElement(){
 				if(long_name) delete[] long_name;
-				delete[] short_name;
 			}
 
 			virtual bool IsDirectory() = 0;
@@ -67,8 +87,10 @@
 			friend class FATDevice;
 			friend class FATDirectory;
 			friend class RootDirectory;
+			friend class StreamingSorter;
+			friend class TreeSnapshot;
 		protected:
-			uint8 *short_name;
+			uint8 short_name[SHORT_NAME_BUFFER_SIZE];
 			uint8 *long_name;
 			uint32 order;
 			bool reordered;
@@ -76,7 +98,8 @@
 
 			vector<GenericEntry> directory_entries;
 
-			static uint8 *GetShortName(const DirectoryEntryStructure *de);
+			static void GetShortName(const DirectoryEntryStructure *de , uint8 *short_name);
+			static void SortByOrder(vector<FATElement*> &fat_elements);
 	};
 
 	class FATFile : public FATElement {
@@ -84,6 +107,9 @@
 			FATFile(const DirectoryEntryStructure *de ,
 				const vector<LongDirectoryEntryStructure> lde):FATElement(de , lde){
 			}
+			FATFile(const vector<GenericEntry> &directory_entries , const uint8 *short_name ,
+				const uint8 *long_name):FATElement(directory_entries , short_name , long_name){
+			}
 			virtual bool IsDirectory(){
 				return false;
 			}
@@ -95,21 +121,34 @@
 			FATDirectory(const DirectoryEntryStructure *de ,
 				const vector<LongDirectoryEntryStructure> lde):FATElement(de , lde){
 			}
+			FATDirectory(const vector<GenericEntry> &directory_entries , const uint8 *short_name ,
+				const uint8 *long_name):FATElement(directory_entries , short_name , long_name){
+			}
 			virtual ~FATDirectory();
 			virtual bool IsDirectory(){
 				return true;
 			}
 			virtual string ToXML(uint32 n_tabs);
 			void InsertFATElement(FATElement *fat_element);
+			/* Sorts the directory and its subdirectories. */
 			void Sort();
+			/* The number of elements in the directory and its subdirectories. */
+			uint32 GetNumberOfElements();
+			/* Applies the order of the directory element to the content and sorts it.
+				The subdirectories are not reordered, they are returned with their elements. */
+			void ReorderContent(DOMElement* directory_element ,
+				vector<pair<FATDirectory* , DOMElement*> > &subdirectories);
+			void GetSubdirectories(vector<FATDirectory*> &subdirectories);
 			friend class FATDevice;
 			friend class RootDirectory;
+			friend class StreamingSorter;
+			friend class TreeSnapshot;
 		private:
 			DirectoryEntryStructure dot, dotdot;
 			vector<FATElement*> content;
-			map<const char* , FATElement* , StringCompare> content_map;
+			ShortNameIndex content_index;
 
-			bool ReorderFATElement(uint8* short_name , uint32 order , FATElement** fat_element);
+			bool ReorderFATElement(const uint8* dir_name , uint32 order , FATElement** fat_element);
 			void ReorderFATDirectory(DOMElement* directory_element);
 	};
 
@@ -117,6 +156,8 @@
 		public:
 			static FATElement* CreateFATElement(const DirectoryEntryStructure *de ,
 				const vector<LongDirectoryEntryStructure> lde);
+			static FATElement* CreateFATElement(const vector<GenericEntry> &directory_entries ,
+				const uint8 *short_name , const uint8 *long_name);
 	};
 
 	class RootDirectory {
@@ -125,18 +166,26 @@
 			void InsertFATElement(FATElement *fat_element);
 			string ToXML();
 			void ImportNewOrder(const char* xml_file);
+			/* Works like FATDirectory::ReorderContent with the root element. */
+			void ReorderContent(DOMElement* root_element ,
+				vector<pair<FATDirectory* , DOMElement*> > &subdirectories);
+			void GetSubdirectories(vector<FATDirectory*> &subdirectories);
+			/* Parses and validates the input file. Xercesc must be initialized. */
+			static XercesDOMParser* ParseInputFile(const char* xml_file);
 
 			class RootDirectoryException : public Exception {
 				public:
 					RootDirectoryException(string message = ""):Exception(message){}
 			};
 			friend class FATDevice;
+			friend class StreamingSorter;
+			friend class TreeSnapshot;
 		private:
 			vector<FATElement*> content;
-			map<const char* , FATElement* , StringCompare> content_map;
+			ShortNameIndex content_index;
 
 			void Sort();
-			bool ReorderFATElement(uint8* short_name , uint32 order, FATElement** fat_element);
+			bool ReorderFATElement(const uint8* dir_name , uint32 order, FATElement** fat_element);
 	};
 
 #endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file_allocation_table.h"
+
+#include <cstring>
+
+using namespace std;
+
+FileAllocationTable::FileAllocationTable(FileIO *device_file , uint32 entry_size ,
+	uint32 bytes_per_sector , const vector<uint32> &fats_first_sector){
+	this->device_file = device_file;
+	this->entry_size = entry_size;
+	this->bytes_per_sector = bytes_per_sector;
+	this->fats_first_sector = fats_first_sector;
+}
+
+vector<uint8>& FileAllocationTable::GetSector(uint32 sector){
+	map<uint32 , vector<uint8> >::iterator iterator = sectors.find(sector);
+
+	if(iterator == sectors.end()){
+		vector<uint8> &data = sectors[sector];
+		data.resize(bytes_per_sector);
+		device_file->Read(data.data() , bytes_per_sector ,
+			(uint64(fats_first_sector[0]) + sector) * bytes_per_sector);
+		return data;
+	}
+	return iterator->second;
+}
+
+uint32 FileAllocationTable::GetEntry(const vector<uint8> &data , uint32 cluster) const{
+	uint32 value = 0;
+
+	memcpy(&value , data.data() + (cluster * entry_size) % bytes_per_sector , entry_size);
+	return entry_size == 4 ? value & 0x0FFFFFFF : value;
+}
+
+uint32 FileAllocationTable::Get(uint32 cluster){
+	return GetEntry(GetSector((cluster * entry_size) / bytes_per_sector) , cluster);
+}
+
+uint32 FileAllocationTable::GetOnDevice(uint32 cluster){
+	uint32 sector = (cluster * entry_size) / bytes_per_sector;
+	map<uint32 , vector<uint8> >::iterator iterator = original_sectors.find(sector);
+
+	/* A sector without changes is the same as on the device. */
+	if(iterator == original_sectors.end()) return GetEntry(GetSector(sector) , cluster);
+	return GetEntry(iterator->second , cluster);
+}
+
+void FileAllocationTable::Set(uint32 cluster , uint32 value){
+	uint32 sector = (cluster * entry_size) / bytes_per_sector;
+	vector<uint8> &data = GetSector(sector);
+	uint8 *entry = data.data() + (cluster * entry_size) % bytes_per_sector;
+
+	if(changed_sectors.find(sector) == changed_sectors.end()) original_sectors[sector] = data;
+	if(entry_size == 4){
+		uint32 old_value;
+		memcpy(&old_value , entry , sizeof(uint32));
+		value = (old_value & 0xF0000000) | (value & 0x0FFFFFFF);
+	}
+	memcpy(entry , &value , entry_size);
+	changed_sectors[sector] = true;
+}
+
+void FileAllocationTable::SerializeChanges(vector<DeviceBlock> &blocks) const{
+	for(map<uint32 , bool>::const_iterator iterator = changed_sectors.begin() ;
+		iterator != changed_sectors.end() ; iterator++){
+		const vector<uint8> &data = sectors.find(iterator->first)->second;
+		for(uint32 i = 0 ; i < fats_first_sector.size() ; i++){
+			blocks.push_back(DeviceBlock());
+			blocks.back().offset = (uint64(fats_first_sector[i]) + iterator->first) * bytes_per_sector;
+			blocks.back().data = data;
+		}
+	}
+}
+
+void FileAllocationTable::DiscardChanges(){
+	/* The sectors read are kept only while they have changes. */
+	sectors.clear();
+	changed_sectors.clear();
+	original_sectors.clear();
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * File Allocation Table Module: keeps the changes made to the FAT entries until they are
+ * serialized to every FAT copy.
+ */
+
+#ifndef YAFS_FILE_ALLOCATION_TABLE_H
+	#define YAFS_FILE_ALLOCATION_TABLE_H
+
+	#include "device_block.h"
+	#include "file_io.h"
+	#include "types.h"
+
+	#include <map>
+	#include <vector>
+	using namespace std;
+
+	class FileAllocationTable {
+		public:
+			/* The entry size must be 2 (FAT16) or 4 (FAT32) bytes. The sectors are read
+				from the first FAT when an entry in them is needed. */
+			FileAllocationTable(FileIO *device_file , uint32 entry_size , uint32 bytes_per_sector ,
+				const vector<uint32> &fats_first_sector);
+
+			/* Returns the entry with the changes not serialized yet. */
+			uint32 Get(uint32 cluster);
+			/* Returns the entry as it is on the device, without the changes not serialized yet. */
+			uint32 GetOnDevice(uint32 cluster);
+			/* On FAT32, the 4 most significant bits of the entry are kept. */
+			void Set(uint32 cluster , uint32 value);
+			/* Appends a block for each changed sector of each FAT copy. */
+			void SerializeChanges(vector<DeviceBlock> &blocks) const;
+			void DiscardChanges();
+			bool HasChanges() const{
+				return !changed_sectors.empty();
+			}
+			/* The value that marks the last cluster of a chain. */
+			uint32 GetEndOfChain() const{
+				return entry_size == 2 ? 0xFFFF : 0x0FFFFFFF;
+			}
+
+		private:
+			FileIO *device_file;
+			uint32 entry_size , bytes_per_sector;
+			vector<uint32> fats_first_sector;
+			/* The sectors read, indexed by their position in the FAT. */
+			map<uint32 , vector<uint8> > sectors;
+			map<uint32 , bool> changed_sectors;
+			/* The content of the changed sectors before their first change. */
+			map<uint32 , vector<uint8> > original_sectors;
+
+			vector<uint8>& GetSector(uint32 sector);
+			uint32 GetEntry(const vector<uint8> &data , uint32 cluster) const;
+	};
+
+#endif
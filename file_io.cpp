@@ -17,15 +17,18 @@
  * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "aligned_buffer_pool.h"
 #include "file_io.h"
 #include "types.h"
 #include "utils.h"
 
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 
 #include <cstdio>
 
+#include <fstream>
 #include <sstream>
 
 using namespace std;
@@ -46,6 +49,11 @@ using namespace std;
 	#include <sys/stat.h>
 	#include <fcntl.h>
 	#include <errno.h>
+	#ifdef __linux__
+		#include <sys/ioctl.h>
+		#include <sys/sysmacros.h>
+		#include <linux/fs.h>
+	#endif
 
    const uint32 FileIO::IO_SEEK_SET = SEEK_SET;
    const uint32 FileIO::IO_SEEK_CUR = SEEK_CUR;
@@ -55,9 +63,15 @@ using namespace std;
 const uint32 FileIO::READ_MODE = 0x1;
 const uint32 FileIO::WRITE_MODE = 0x2;
 
-FileIO::FileIO(const char* path , const char* mode , bool lock){
+FileIO::FileIO(const char* path , const char* mode , bool lock , bool direct){
 
 	if(mode == NULL) throw FileIOException("The second parameter is invalid.");
+	this->direct = false;
+	sync_on_close = true;
+	base_offset = 0;
+	alignment = 1;
+	bounce_buffer = NULL;
+	bounce_buffer_size = 0;
 
 	/* Windows. */
 	#ifdef WIN_SYSTEM
@@ -111,7 +125,24 @@ FileIO::FileIO(const char* path , const char* mode , bool lock){
 		}else throw FileIOException("The second parameter is invalid.");
 
 		#ifdef __linux__
-			file = open(path , flags , S_IRUSR | S_IWUSR | O_LARGEFILE);
+			struct stat file_status;
+			bool is_block_device = stat(path , &file_status) == 0 && S_ISBLK(file_status.st_mode);
+
+			file = -1;
+			if(direct || is_block_device){
+				file = open(path , flags | O_DIRECT , S_IRUSR | S_IWUSR | O_LARGEFILE);
+				/* Some file systems do not support direct I/O. */
+				if(file != -1){
+					this->direct = true;
+					if(is_block_device){
+						int logical_block_size;
+						alignment = ioctl(file , BLKSSZGET , &logical_block_size) == 0 ? logical_block_size : 512;
+					}else{
+						alignment = file_status.st_size % file_status.st_blksize == 0 ? file_status.st_blksize : 512;
+					}
+				}
+			}
+			if(file == -1) file = open(path , flags , S_IRUSR | S_IWUSR | O_LARGEFILE);
 		#else
 			file = open(path , flags , S_IRUSR | S_IWUSR);
 		#endif
@@ -125,7 +156,7 @@ void FileIO::Close(){
 	#ifdef WIN_SYSTEM
 		DWORD unused;
 		if (mode & WRITE_MODE) {
-			if (FlushFileBuffers(file) == 0) {
+			if (sync_on_close && FlushFileBuffers(file) == 0) {
 				throwIOExceptionWithErrorCode("Error while closing the file.");
 			}
 
@@ -138,12 +169,14 @@ void FileIO::Close(){
 			throwIOExceptionWithErrorCode("Error while closing the file.");
 	/* Unix. */
 	#elif UNIX_SYSTEM
-		if(fsync(file) != 0)
-			throwIOExceptionWithErrorCode("Error while closing the file.");
+		/* A file opened only for reading has nothing of ours to flush. */
+		if((mode & WRITE_MODE) && sync_on_close)
+			Sync();
 
 		if(close(file) != 0)
 			throwIOExceptionWithErrorCode("Error while closing the file.");
    #endif
+	if(bounce_buffer != NULL) AlignedBufferPool::Free(bounce_buffer);
 }
 
 uint32 FileIO::ReadInternal(void* buffer , uint32 count){
@@ -173,10 +206,13 @@ uint32 FileIO::ReadInternal(void* buffer , uint32 count){
 }
 
 uint32 FileIO::Read(void *buffer , uint32 count , uint64 offset){
+	offset += base_offset;
 	if (LogUtils::IsEnabled()) {
 		LogUtils::Debug() << "Reading " << count << " bytes from 0x" << hex << offset << dec << "." << endl;
 	}
 
+	std::lock_guard<std::mutex> lock(io_mutex);
+	if(direct && !IsAligned(buffer , count , offset)) return ReadBounced(buffer , count , offset);
 	SeekInternal(offset , IO_SEEK_SET);
 	return ReadInternal(buffer , count);
 }
@@ -209,14 +245,135 @@ uint32 FileIO::WriteInternal(const void* buffer , uint32 count){
 }
 
 uint32 FileIO::Write(const void *buffer , uint32 count , uint64 offset){
+	offset += base_offset;
 	if (LogUtils::IsEnabled()) {
 		LogUtils::Debug() << "Writing " << count << " bytes on 0x" << hex << offset << dec << "." << endl;
 	}
 
+	std::lock_guard<std::mutex> lock(io_mutex);
+	if(direct && !IsAligned(buffer , count , offset)) return WriteBounced(buffer , count , offset);
 	SeekInternal(offset , IO_SEEK_SET);
 	return WriteInternal(buffer , count);
 }
 
+bool FileIO::IsAligned(const void *buffer , uint32 count , uint64 offset) const{
+	return ((uintptr_t)buffer) % alignment == 0 && count % alignment == 0 && offset % alignment == 0;
+}
+
+void FileIO::ReserveBounceBuffer(uint32 size){
+	if(size <= bounce_buffer_size) return;
+	if(bounce_buffer != NULL) AlignedBufferPool::Free(bounce_buffer);
+	bounce_buffer = NULL;
+	bounce_buffer_size = 0;
+	bounce_buffer = AlignedBufferPool::Allocate(size , alignment);
+	bounce_buffer_size = size;
+}
+
+uint32 FileIO::ReadBounced(void *buffer , uint32 count , uint64 offset){
+	uint64 aligned_offset = offset - offset % alignment;
+	uint32 aligned_count = (uint32)(((offset + count + alignment - 1) / alignment) * alignment - aligned_offset);
+
+	ReserveBounceBuffer(aligned_count);
+	SeekInternal(aligned_offset , IO_SEEK_SET);
+	ReadInternal(bounce_buffer , aligned_count);
+	memcpy(buffer , bounce_buffer + (offset - aligned_offset) , count);
+	return count;
+}
+
+uint32 FileIO::WriteBounced(const void *buffer , uint32 count , uint64 offset){
+	uint64 aligned_offset = offset - offset % alignment;
+	uint32 aligned_count = (uint32)(((offset + count + alignment - 1) / alignment) * alignment - aligned_offset);
+
+	ReserveBounceBuffer(aligned_count);
+	/* The blocks are read first when the range does not cover them completely. */
+	if(offset % alignment != 0 || (offset + count) % alignment != 0){
+		SeekInternal(aligned_offset , IO_SEEK_SET);
+		ReadInternal(bounce_buffer , aligned_count);
+	}
+	memcpy(bounce_buffer + (offset - aligned_offset) , buffer , count);
+	SeekInternal(aligned_offset , IO_SEEK_SET);
+	WriteInternal(bounce_buffer , aligned_count);
+	return count;
+}
+
+void FileIO::Sync(){
+	if (mode & WRITE_MODE) {
+		/* Windows. */
+		#ifdef WIN_SYSTEM
+			if(!FlushFileBuffers((HANDLE)file))
+				throwIOExceptionWithErrorCode("Error while flushing the file.");
+		/* Unix. */
+		#elif UNIX_SYSTEM
+			/* The size of the device does not change, so only the data is flushed. */
+			#ifdef __linux__
+				if(fdatasync(file) == -1)
+			#else
+				if(fsync(file) == -1)
+			#endif
+				throwIOExceptionWithErrorCode("Error while flushing the file.");
+		#endif
+	}
+}
+
+#ifdef __linux__
+	/* Reads a number from a sysfs file. */
+	static bool ReadSysfsValue(const string &path , uint64 &value){
+		ifstream file(path.c_str());
+
+		return (file >> value) && value > 0;
+	}
+#endif
+
+bool FileIO::GetEraseBlock(uint32 &erase_block_size , uint64 &start){
+	#ifdef __linux__
+		struct stat file_status;
+		uint64 value , sectors;
+		ostringstream stream;
+		string device_path , disk_path;
+
+		if(fstat(file , &file_status) != 0 || !S_ISBLK(file_status.st_mode)) return false;
+		stream << "/sys/dev/block/" << major(file_status.st_rdev) << ":" << minor(file_status.st_rdev);
+		device_path = stream.str();
+		/* A partition is a subdirectory of its disk and its start is in 512 byte sectors. */
+		start = 0;
+		disk_path = device_path;
+		if(ReadSysfsValue(device_path + "/partition" , value)){
+			disk_path = device_path + "/..";
+			if(ReadSysfsValue(device_path + "/start" , sectors)) start = sectors * 512;
+		}
+		/* SD and eMMC cards report their erase block. Other devices may report the
+			granularity of a discard, that is usually the same. */
+		if(ReadSysfsValue(disk_path + "/device/preferred_erase_size" , value) ||
+			ReadSysfsValue(disk_path + "/queue/discard_granularity" , value)){
+			if(value <= 0xFFFFFFFF){
+				erase_block_size = (uint32)value;
+				return true;
+			}
+		}
+	#endif
+	return false;
+}
+
+bool FileIO::GetDeviceNumbers(uint32 &major_number , uint32 &minor_number , uint64 &inode){
+	#ifdef __linux__
+		struct stat file_status;
+
+		if(fstat(file , &file_status) != 0) return false;
+		if(S_ISBLK(file_status.st_mode)){
+			major_number = major(file_status.st_rdev);
+			minor_number = minor(file_status.st_rdev);
+			inode = 0;
+		}else{
+			major_number = major(file_status.st_dev);
+			minor_number = minor(file_status.st_dev);
+			inode = file_status.st_ino;
+		}
+		return true;
+	#else
+		return false;
+	#endif
+}
+
 void FileIO::SeekInternal(uint64 offset , uint32 mode){
 	/* Windows. */
 	#ifdef WIN_SYSTEM
@@ -27,6 +27,7 @@
 	#include "exception.h"
 	#include "types.h"
 
+	#include <mutex>
 	#include <string>
 
 	using namespace std;
@@ -52,10 +53,43 @@
 
    class FileIO {
       public:
-         FileIO(const char *path , const char *mode , bool lock = true);
+         /* If direct is true, the file is opened for direct I/O, bypassing the system
+				cache. On Linux, block devices always use direct I/O. */
+         FileIO(const char *path , const char *mode , bool lock = true , bool direct = false);
 
+			/* Read and Write can be called by several threads at the same time. */
 			uint32 Read(void *buffer , uint32 count , uint64 offset);
 			uint32 Write(const void *buffer , uint32 count , uint64 offset);
+			/* Makes sure that everything written so far reached the device. */
+			void Sync();
+			/* If it is false, Close does not flush the file. Only files opened for
+				writing are flushed. */
+			void SetSyncOnClose(bool sync_on_close){
+				this->sync_on_close = sync_on_close;
+			}
+			/* With direct I/O, the buffer, the offset and the count of a read or write
+				should be aligned to this value. Otherwise a bounce buffer is used. */
+			uint32 GetAlignment() const{
+				return alignment;
+			}
+			bool IsDirect() const{
+				return direct;
+			}
+			/* The offsets given to Read and Write are relative to the base offset, so a
+				partition of a disk image can be used as a whole file. */
+			void SetBaseOffset(uint64 base_offset){
+				this->base_offset = base_offset;
+			}
+			uint64 GetBaseOffset() const{
+				return base_offset;
+			}
+			/* Gets the erase block size that a block device reports and the offset of the
+				device inside its disk. Returns false if it is not known. */
+			bool GetEraseBlock(uint32 &erase_block_size , uint64 &start);
+			/* Gets the numbers of the block device, or of the device that stores the file,
+				and the inode of the file (zero for a block device). Returns false if they
+				are not known. */
+			bool GetDeviceNumbers(uint32 &major_number , uint32 &minor_number , uint64 &inode);
 
          ~FileIO(){
             Close();
@@ -78,11 +112,23 @@
 			uint32 ReadInternal(void* buffer , uint32 count);
 			uint32 WriteInternal(const void* buffer , uint32 count);
 			void SeekInternal(uint64 offset , uint32 mode);
+			bool IsAligned(const void *buffer , uint32 count , uint64 offset) const;
+			/* Reads or writes the aligned blocks that contain the range through the bounce
+				buffer. */
+			uint32 ReadBounced(void *buffer , uint32 count , uint64 offset);
+			uint32 WriteBounced(const void *buffer , uint32 count , uint64 offset);
+			void ReserveBounceBuffer(uint32 size);
 
 			void throwIOExceptionWithErrorCode(string message);
 
          File file;
-         uint32 mode;
+         uint32 mode , alignment;
+			uint64 base_offset;
+			bool direct , sync_on_close;
+			uint8 *bounce_buffer;
+			uint32 bounce_buffer_size;
+			/* The seek and the read or write must not be interleaved with other threads. */
+			std::mutex io_mutex;
    };
 
 #endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checksum.h"
+#include "journal.h"
+#include "pack.h"
+#include "types.h"
+#include "utils.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+/* Windows. */
+#ifdef WIN_SYSTEM
+	#include <io.h>
+/* Unix. */
+#elif UNIX_SYSTEM
+	#include <unistd.h>
+#endif
+
+using namespace std;
+
+#define JOURNAL_SIGNATURE "YAFSJRNL"
+#define JOURNAL_VERSION 1
+
+/* File format: a header followed by number_of_blocks blocks, each one with a
+	JournalBlockHeader followed by its data. The numbers are stored in the byte order of
+	the machine, like the FAT structures are read, so a journal must be rolled back on a
+	machine with the same byte order. */
+PACK(struct JournalHeader{
+	uint8 signature[8];
+	uint32 version;
+	uint32 volume_id;
+	uint32 state;
+	uint32 number_of_blocks;
+	/* The checksum is computed with the state and the checksum fields equal to zero,
+		so the state can be changed later without rewriting it. */
+	uint32 checksum;
+});
+#ifndef __APPLE__
+	static_assert(sizeof(JournalHeader) == 28, "Expecting JournalHeader with 28 bytes length");
+#endif
+
+PACK(struct JournalBlockHeader{
+	uint64 offset;
+	uint32 size;
+	/* The checksum of the offset, the size and the data. */
+	uint32 checksum;
+});
+#ifndef __APPLE__
+	static_assert(sizeof(JournalBlockHeader) == 16, "Expecting JournalBlockHeader with 16 bytes length");
+#endif
+
+uint32 ComputeHeaderCheckSum(JournalHeader header){
+	header.state = 0;
+	header.checksum = 0;
+	return Checksum::CRC32C(&header , sizeof(JournalHeader));
+}
+
+uint32 ComputeBlockCheckSum(JournalBlockHeader block_header , const uint8 *data){
+	block_header.checksum = 0;
+	return Checksum::CRC32C(data , block_header.size ,
+		Checksum::CRC32C(&block_header , sizeof(JournalBlockHeader)));
+}
+
+/* Flushes the stream buffer and asks the operating system to write the file to the disk. */
+bool SyncFile(FILE *file){
+	if(fflush(file) != 0) return false;
+	/* Windows. */
+	#ifdef WIN_SYSTEM
+		return _commit(_fileno(file)) == 0;
+	/* Unix. */
+	#elif UNIX_SYSTEM
+		return fsync(fileno(file)) == 0;
+	#endif
+}
+
+Journal::Journal(const char *path){
+	this->path = path;
+	volume_id = 0;
+	state = PREPARED;
+}
+
+void Journal::AddBlock(uint64 offset , const uint8 *data , uint32 size){
+	DeviceBlock block;
+
+	block.offset = offset;
+	block.data.assign(data , data + size);
+	blocks.push_back(block);
+}
+
+uint64 Journal::GetSize() const{
+	uint64 size = sizeof(JournalHeader);
+
+	for(uint32 i = 0 ; i < blocks.size() ; i++)
+		size += sizeof(JournalBlockHeader) + blocks[i].data.size();
+	return size;
+}
+
+void Journal::Prepare(uint32 volume_id){
+	JournalHeader header;
+	FILE *file;
+	bool success = true;
+
+	this->volume_id = volume_id;
+	state = PREPARED;
+
+	memcpy(header.signature , JOURNAL_SIGNATURE , sizeof(header.signature));
+	header.version = JOURNAL_VERSION;
+	header.volume_id = volume_id;
+	header.number_of_blocks = (uint32)blocks.size();
+	header.checksum = 0;
+	header.checksum = ComputeHeaderCheckSum(header);
+	header.state = state;
+
+	if((file = fopen(path.c_str() , "wb")) == NULL)
+		throw JournalException(string("The journal file \"") + path + "\" could not be created.");
+
+	success = fwrite(&header , sizeof(JournalHeader) , 1 , file) == 1;
+	for(uint32 i = 0 ; i < blocks.size() && success ; i++){
+		JournalBlockHeader block_header;
+		block_header.offset = blocks[i].offset;
+		block_header.size = (uint32)blocks[i].data.size();
+		block_header.checksum = ComputeBlockCheckSum(block_header , blocks[i].data.data());
+		success = fwrite(&block_header , sizeof(JournalBlockHeader) , 1 , file) == 1 &&
+			fwrite(blocks[i].data.data() , 1 , blocks[i].data.size() , file) == blocks[i].data.size();
+	}
+	success = SyncFile(file) && success;
+	success = fclose(file) == 0 && success;
+	if(!success)
+		throw JournalException(string("Error while writing the journal file \"") + path + "\".");
+
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The journal has " << blocks.size() << " blocks and " <<
+			GetSize() << " bytes." << endl;
+	}
+}
+
+void Journal::Commit(){
+	state = COMMITTED;
+	WriteState();
+}
+
+void Journal::WriteState(){
+	FILE *file;
+	uint32 aux = state;
+	bool success;
+
+	if((file = fopen(path.c_str() , "r+b")) == NULL)
+		throw JournalException(string("The journal file \"") + path + "\" could not be opened.");
+	success = fseek(file , offsetof(JournalHeader , state) , SEEK_SET) == 0 &&
+		fwrite(&aux , sizeof(uint32) , 1 , file) == 1;
+	success = SyncFile(file) && success;
+	success = fclose(file) == 0 && success;
+	if(!success)
+		throw JournalException(string("Error while writing the journal file \"") + path + "\".");
+}
+
+void Journal::Load(){
+	JournalHeader header;
+	FILE *file;
+	long file_size;
+	string error;
+
+	if((file = fopen(path.c_str() , "rb")) == NULL)
+		throw JournalException(string("The journal file \"") + path + "\" could not be opened.");
+	/* The size of each block is checked against the rest of the file before its
+		buffer is allocated, so a corrupted size can not exhaust the memory. */
+	if(fseek(file , 0 , SEEK_END) != 0 || (file_size = ftell(file)) < 0 || fseek(file , 0 , SEEK_SET) != 0){
+		fclose(file);
+		throw JournalException(string("The journal file \"") + path + "\" could not be read.");
+	}
+
+	blocks.clear();
+	if(fread(&header , sizeof(JournalHeader) , 1 , file) != 1 ||
+		memcmp(header.signature , JOURNAL_SIGNATURE , sizeof(header.signature)) ||
+		header.version != JOURNAL_VERSION ||
+		header.checksum != ComputeHeaderCheckSum(header) ||
+		(header.state != PREPARED && header.state != COMMITTED)){
+		error = "The journal file \"" + path + "\" is invalid.";
+	}
+
+	for(uint32 i = 0 ; error.empty() && i < header.number_of_blocks ; i++){
+		JournalBlockHeader block_header;
+		DeviceBlock block;
+
+		if(fread(&block_header , sizeof(JournalBlockHeader) , 1 , file) != 1){
+			error = "The journal file \"" + path + "\" is incomplete.";
+			break;
+		}
+		if(block_header.size > uint64(file_size - ftell(file))){
+			error = "The journal file \"" + path + "\" is incomplete.";
+			break;
+		}
+		block.offset = block_header.offset;
+		block.data.resize(block_header.size);
+		if(fread(block.data.data() , 1 , block_header.size , file) != block_header.size){
+			error = "The journal file \"" + path + "\" is incomplete.";
+		}else if(ComputeBlockCheckSum(block_header , block.data.data()) != block_header.checksum){
+			error = "The journal file \"" + path + "\" has a corrupted block.";
+		}else{
+			blocks.push_back(block);
+		}
+	}
+	fclose(file);
+
+	if(!error.empty()){
+		blocks.clear();
+		throw JournalException(error);
+	}
+	volume_id = header.volume_id;
+	state = (State)header.state;
+}
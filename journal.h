@@ -0,0 +1,81 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Journal Module: keeps the original content of the device blocks that will be overwritten,
+ * so an interrupted (or unwanted) write can be rolled back.
+ */
+
+#ifndef YAFS_JOURNAL_H
+	#define YAFS_JOURNAL_H
+
+	#include "device_block.h"
+	#include "exception.h"
+	#include "types.h"
+
+	#include <string>
+	#include <vector>
+	using namespace std;
+
+	class Journal {
+		public:
+			enum State {
+				/* The original blocks are saved but the device may be partially written. */
+				PREPARED = 1,
+				/* The device was completely written. */
+				COMMITTED = 2
+			};
+
+			Journal(const char *path);
+
+			/* Saves the original content of a block before it is overwritten. */
+			void AddBlock(uint64 offset , const uint8 *data , uint32 size);
+			/* Writes the journal file and flushes it to the disk. It must be called
+				before the device is changed. */
+			void Prepare(uint32 volume_id);
+			void Commit();
+			/* Reads the journal file checking all its checksums. */
+			void Load();
+
+			uint32 GetVolumeID() const{
+				return volume_id;
+			}
+			State GetState() const{
+				return state;
+			}
+			const vector<DeviceBlock>& GetBlocks() const{
+				return blocks;
+			}
+			uint64 GetSize() const;
+
+			class JournalException : public Exception {
+				public:
+					JournalException(string message = ""):Exception(message){}
+			};
+
+		private:
+			string path;
+			uint32 volume_id;
+			State state;
+			vector<DeviceBlock> blocks;
+
+			void WriteState();
+	};
+
+#endif
@@ -22,11 +22,27 @@
 #include "command_line_parser.h"
 #include "exception.h"
 #include "fat_device.h"
+#include "partition_table.h"
+#include "pipelined_sorter.h"
+#include "spool_directory.h"
+#include "streaming_sorter.h"
+#include "thread_pool.h"
+#include "unicode.h"
 #include "utils.h"
 #include "version.h"
+#include "xercesc.h"
 
 #include <cassert>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
 
 using namespace std;
 
@@ -34,21 +50,150 @@ enum OperationMode {
 	READ_DIRECTORIES_TREE,
 	WRITE_DIRECTORIES_TREE,
 	FETCH_DEVICE_INFORMATION,
+	ROLL_BACK_JOURNAL,
+	CREATE_WRITE_PLAN,
+	APPLY_WRITE_PLAN,
+	CLONE_TO_TARGETS,
+	RUN_BATCH,
+	RUN_DAEMON,
 	INVALID_MODE
 };
 
 void PrintHelp(){
 	cerr <<
-		"Usage: yafs -d device_path -f file_path -{r | w} [-v]" << endl <<
-		"       yafs -d device_path -i [-v]" << endl << endl <<
+		"Usage: yafs -d device_path -f file_path -{r | w} [-c code_page] [-j journal_path]" << endl <<
+		"            [-k cache_directory_path] [-p directory_path] [-q queue_depth] [-m]" << endl <<
+		"            [-g] [-x] [-y packing_unit] [-v]" << endl <<
+		"       yafs -d device_path -f file_path -w -{l | o} [-c code_page]" << endl <<
+		"            [-p directory_path] [-m] [-y packing_unit] [-v]" << endl <<
+		"       yafs -d device_path -f file_path -n plan_path [-c code_page]" << endl <<
+		"            [-k cache_directory_path] [-p directory_path] [-q queue_depth] [-m]" << endl <<
+		"            [-g] [-y packing_unit] [-v]" << endl <<
+		"       yafs -d device_path -a plan_path [-j journal_path] [-v]" << endl <<
+		"       yafs -d device_path -f file_path -t targets_path [-c code_page]" << endl <<
+		"            [-k cache_directory_path] [-p directory_path] [-q queue_depth] [-m]" << endl <<
+		"            [-g] [-y packing_unit] [-v]" << endl <<
+		"       yafs -d device_path -j journal_path -u [-v]" << endl <<
+		"       yafs -b manifest_path [-c code_page] [-k cache_directory_path] [-l | -o]" << endl <<
+		"            [-q queue_depth] [-m] [-g] [-x] [-y packing_unit] [-v]" << endl <<
+		"       yafs -s spool_directory_path [-c code_page] [-k cache_directory_path]" << endl <<
+		"            [-l | -o] [-q queue_depth] [-m] [-g] [-x] [-y packing_unit]" << endl <<
+		"            [-v]" << endl <<
+		"       yafs -d device_path -i [-v]" << endl <<
+		"All the forms accept the -z option. The forms that write the device also accept" << endl <<
+		"the -D durability and the -e erase_block_size options. The forms that accept" << endl <<
+		"the -q option also accept the -T option." << endl << endl <<
 		"-v   Activates the verbose mode that will print debug information." << endl <<
+		"-c   It is used to specify the code page used to decode the short names. The" << endl <<
+		"     argument must be \"latin1\" (default), \"cp437\", \"cp850\" or \"cp1252\"." << endl <<
+		"     The same code page must be used with the -r and -w options." << endl << endl <<
 		"-d   It is used to specify the device that has a FAT file system. On Windows," << endl <<
 		"     the argument must be the device letter, i.e. \"e:\". On Unix, the" << endl <<
-		"     argument is the device file, i.e. \"/dev/hdb1\"." << endl << endl <<
+		"     argument is the device file, i.e. \"/dev/hdb1\". If the device or image has" << endl <<
+		"     a MBR or GPT, the partition is given as \"image.img:N\". Without it, the" << endl <<
+		"     only FAT partition is used or, if there are more, all FAT partitions are" << endl <<
+		"     processed at the same time and \".N\" is appended to the paths of the" << endl <<
+		"     files given with the -f, -j, -n and -a options." << endl << endl <<
 		"-f   It is used to specify the input or output file. If the option -r is used," << endl <<
 		"     the program will use this file to store the current file system directory" << endl <<
 		"     tree. If the option -w is used, the program will read the sorted file" << endl <<
 		"     system directory tree from the file." << endl << endl <<
+		"-n   It works like the -w option but, instead of changing the device file" << endl <<
+		"     system, the program will store the blocks that would be written in the" << endl <<
+		"     plan file specified as argument. The plan can be written later with the" << endl <<
+		"     -a option." << endl << endl <<
+		"-a   With this option the program will write the plan file specified as" << endl <<
+		"     argument (created with the -n option) to the device. The plan is only" << endl <<
+		"     written if the device has not changed since the plan was created." << endl << endl <<
+		"-t   It works like the -w option but the device specified with -d option is" << endl <<
+		"     only read and the sorted directories are written to the devices listed in" << endl <<
+		"     the targets file specified as argument (one device per line). All target" << endl <<
+		"     devices are written in parallel and each one must have the same boot" << endl <<
+		"     sector, FAT and directories as the device specified with -d option." << endl << endl <<
+		"-b   With this option the program will run all the jobs listed in the manifest" << endl <<
+		"     file specified as argument in parallel. Each line of the manifest has a" << endl <<
+		"     device path, a file path and a mode (\"r\" or \"w\", like the -r and -w" << endl <<
+		"     options) separated by tabs. A summary with the exit status and the" << endl <<
+		"     duration of each job is printed at the end." << endl << endl <<
+		"-s   With this option the program keeps running and processes the job files" << endl <<
+		"     dropped in the spool directory specified as argument. A job file must" << endl <<
+		"     have the \".job\" extension and the same format of the -b option manifest." << endl <<
+		"     It should be created with another name and renamed when complete. After" << endl <<
+		"     the jobs run, the job file is removed and the summary is written in a" << endl <<
+		"     file with the same name and the \".result\" extension. A job file that can" << endl <<
+		"     not be processed or removed is renamed to the \".failed\" extension." << endl << endl <<
+		"-k   It is used to specify a directory where a snapshot of each directory tree" << endl <<
+		"     read is stored. The next time the same volume is read, only the directories" << endl <<
+		"     whose clusters have changed are parsed again. The others are restored from" << endl <<
+		"     the snapshot. The clusters of every directory are still read to find the" << endl <<
+		"     ones that have changed, so the device is always read." << endl << endl <<
+		"-p   It is used to specify the path of a directory, i.e. \"/MUSIC/ROCK\", so" << endl <<
+		"     only the directories inside it are read and sorted. Each directory in the" << endl <<
+		"     path may be given by its short or long name. The file specified with -f" << endl <<
+		"     option has the content of this directory instead of the root directory." << endl << endl <<
+		"-l   With this option the -w option reads the input file and the device one" << endl <<
+		"     directory at a time and writes each directory when its end is reached in" << endl <<
+		"     the input file. The memory used depends on the largest directory instead" << endl <<
+		"     of the whole file system. The input file is checked against the device" << endl <<
+		"     before anything is written. It can't be combined with the -j option." << endl << endl <<
+		"-o   With this option the -w option reads the directories, sorts them and" << endl <<
+		"     prepares their blocks at the same time using three threads. The result is" << endl <<
+		"     the same. If the input file does not match the device, it stops before" << endl <<
+		"     anything is written. It can't be combined with the -j or -l options." << endl << endl <<
+		"-q   It is used to specify how many directories are read at the same time by a" << endl <<
+		"     single thread. The directories waiting for a cluster are suspended and" << endl <<
+		"     their clusters are read together in ascending order, merging the" << endl <<
+		"     contiguous ones. Without this option, the directories are read one at a" << endl <<
+		"     time recursively. It can't be combined with the -l or -o options." << endl << endl <<
+		"-T   With this option the queue depth of the -q option, the size of the reads" << endl <<
+		"     and the number of partitions processed at the same time are chosen from" << endl <<
+		"     the queue attributes in /sys/block (the YAFS_SYSFS_ROOT environment" << endl <<
+		"     variable replaces /sys) and from the time of some reads of the device." << endl <<
+		"     The choice is stored in the directory of the -k option. A queue depth given" << endl <<
+		"     with the -q option is kept." << endl << endl <<
+		"-m   With this option the deleted entries are dropped and each directory is" << endl <<
+		"     written in the minimum number of clusters. The clusters left at the end of" << endl <<
+		"     a directory are freed in every FAT. The FAT16 root directory, which has a" << endl <<
+		"     fixed size, is not compacted." << endl << endl <<
+		"-g   With this option each directory whose clusters are not contiguous is" << endl <<
+		"     moved to contiguous free clusters, so it can be read at once. The FAT32" << endl <<
+		"     root directory and the directory specified with -p option are not moved." << endl <<
+		"     It can't be combined with the -l or -o options." << endl << endl <<
+		"-x   With this option the -w option also moves the clusters of the files to" << endl <<
+		"     contiguous free clusters, so the files are stored one after another in" << endl <<
+		"     the sorted order. The files are copied before the directories are written" << endl <<
+		"     and the files already in place are not copied. It can't be combined with" << endl <<
+		"     the -l or -o options." << endl << endl <<
+		"-y   It is used to avoid that the entries of a file or directory name are" << endl <<
+		"     split between two clusters or sectors. The argument must be \"cluster\" or" << endl <<
+		"     \"sector\". Deleted entries are written before the name when the directory" << endl <<
+		"     has enough free entries. With the -v option, the number of names split" << endl <<
+		"     with and without this option is printed." << endl << endl <<
+		"-D   It is used to choose when the device is flushed. The argument must be" << endl <<
+		"     \"none\", \"end\" or \"ordered\". With \"none\", the device is never flushed," << endl <<
+		"     which is enough for an image that is copied afterwards. With \"end\", the" << endl <<
+		"     default, it is flushed at the end, after the moved files and before a" << endl <<
+		"     journal is committed. With \"ordered\", the moved files, the clusters" << endl <<
+		"     allocated in the FAT, the directories and the rest of the FAT are each" << endl <<
+		"     flushed before the next one is written. \"none\" can't be combined with the" << endl <<
+		"     -j option, except with the -u option." << endl << endl <<
+		"-e   It is used to give the erase block size of a flash card, in bytes or with" << endl <<
+		"     a \"K\" or \"M\" suffix, or \"auto\" to get it from the device (4M is used" << endl <<
+		"     if the device does not report it). The blocks written inside the same" << endl <<
+		"     erase block are written at once, in ascending order, so the card erases" << endl <<
+		"     it only once. With the -v option, the number of erase blocks written is" << endl <<
+		"     printed." << endl << endl <<
+		"-z   With this option the device is read and written with direct I/O, without" << endl <<
+		"     the system cache, when the file system supports it. On Linux, direct I/O" << endl <<
+		"     is always used for block devices." << endl << endl <<
+		"-j   It is used to specify a journal file. With the -w or -a options, the" << endl <<
+		"     original content of every block that will be changed is saved in this" << endl <<
+		"     file before the device is written. With the -u option, the saved content" << endl <<
+		"     is restored." << endl <<
+		"     The journal file must not be stored in the device being sorted." << endl << endl <<
+		"-u   With this option the program will roll back the device to the state saved" << endl <<
+		"     in the journal file specified with the -j option. It can't be combined" << endl <<
+		"     with the -i, -r, -w, -n or -a options." << endl << endl <<
 		"-i   With this option, the program only prints some information about the" << endl <<
 		"     device file system. It can't be combined with the -r or -w options." << endl << endl <<
 		"-r   With this option the program will print the current file system directory" << endl <<
@@ -66,11 +211,530 @@ void PrintErrorMessage(){
 	cerr << "Invalid program call. Try \"yafs -h\" to see the help." << endl;
 }
 
-#include "utils.h"
+/* Converts the device path given by the user to the path used to open the device. */
+bool GetFinalDevicePath(const char *device_path , string &final_device_path){
+	#ifdef WIN_SYSTEM
+		if(strlen(device_path) != 2 || device_path[1] != ':')
+			return false;
+		final_device_path = "\\\\.\\?:";
+		final_device_path[4] = device_path[0];
+	#elif UNIX_SYSTEM
+		final_device_path = device_path;
+	#endif
+	return true;
+}
+
+/* Reads the targets file that has one device path per line. */
+bool ReadTargets(const char *targets_path , vector<string> &targets){
+	ifstream targets_file(targets_path);
+	string line;
+
+	if(!targets_file.is_open()) return false;
+	while(getline(targets_file , line)){
+		if(!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+		if(!line.empty()) targets.push_back(line);
+	}
+	return !targets.empty();
+}
+
+/* Applies the plan to all targets in parallel using one thread per target. */
+bool CloneToTargets(const WritePlan &write_plan , const vector<string> &targets , bool direct_io ,
+	FATDevice::DurabilityPolicy durability_policy , uint32 erase_block_size){
+	vector<string> errors(targets.size());
+	uint32 i , failures = 0;
+
+	{
+		ThreadPool thread_pool((uint32)targets.size());
+		for(i = 0 ; i < targets.size() ; i++){
+			thread_pool.Submit([&write_plan , &targets , &errors , i , direct_io , durability_policy ,
+				erase_block_size](){
+				string final_target_path;
+				if(!GetFinalDevicePath(targets[i].c_str() , final_target_path)){
+					errors[i] = "Invalid device path.";
+					return;
+				}
+				try{
+					FATDevice target(final_target_path.c_str() , "r+" , direct_io);
+					target.SetDurabilityPolicy(durability_policy);
+					target.SetEraseBlockSize(erase_block_size);
+					target.ApplyWritePlan(write_plan);
+				}catch(Exception e){
+					errors[i] = e;
+				}
+			});
+		}
+		thread_pool.Wait();
+	}
+
+	for(i = 0 ; i < targets.size() ; i++){
+		if(errors[i].empty()){
+			cout << "\"" << targets[i] << "\": OK" << endl;
+		}else{
+			cout << "\"" << targets[i] << "\": " << errors[i] << endl;
+			failures++;
+		}
+	}
+	cout << (targets.size() - failures) << " of " << targets.size() << " devices were written." << endl;
+	return failures == 0;
+}
+
+/* A device operation. The paths that the operation does not use are empty. */
+struct Job {
+	OperationMode operation_mode;
+	string device_path , io_file_path , journal_path , plan_path , targets_path;
+	/* If it is not empty, the tree snapshots are stored in this directory. */
+	string snapshot_cache_directory;
+	/* If it is not empty, only this directory is read and written. */
+	string subtree_path;
+	/* If it is true, the device is sorted one directory at a time. */
+	bool streaming;
+	/* If it is true, the directories are read, sorted and written by different threads. */
+	bool pipelined;
+	/* If it is not zero, the directories are read by an event loop. */
+	uint32 scan_queue_depth;
+	/* If it is true, the clusters not needed by the directories are freed. */
+	bool compact;
+	/* If it is true, the fragmented directories are moved to contiguous clusters. */
+	bool defragment;
+	/* If it is true, the file clusters are moved to follow the sorted order. */
+	bool relocate_files;
+	FATDevice::PackingPolicy packing_policy;
+	/* If it is true, the device is read and written without the system cache. */
+	bool direct_io;
+	/* If it is true, the way the device is read is chosen from its characteristics. */
+	bool auto_tune;
+	FATDevice::DurabilityPolicy durability_policy;
+	/* If it is not zero, the writes are grouped by erase block. */
+	uint32 erase_block_size;
+};
+
+/* With -T, the queue depth and the read size come from the device unless -q was given. */
+void TuneReading(FATDevice *fat_device , const Job &job){
+	if(job.auto_tune) fat_device->AutoTune();
+	if(!job.auto_tune || job.scan_queue_depth > 0) fat_device->SetScanQueueDepth(job.scan_queue_depth);
+}
+
+/* The jobs of the partitions of a device run at the same time and print to cout. */
+std::mutex output_mutex;
+
+/* Runs the job. If it fails, the error is stored in error_message. */
+bool RunJob(const Job &job , string &error_message){
+	std::unique_ptr<FATDevice> fat_device;
+	std::unique_ptr<RootDirectory> root_directory;
+	string final_device_path;
+
+	if(!GetFinalDevicePath(job.device_path.c_str() , final_device_path)){
+		error_message = "Invalid device path \"" + job.device_path + "\".";
+		return false;
+	}
+
+	try{
+		switch(job.operation_mode){
+			case READ_DIRECTORIES_TREE:{
+				fat_device.reset(new FATDevice(final_device_path.c_str(), "r" , job.direct_io));
+				fat_device->SetSnapshotCacheDirectory(job.snapshot_cache_directory);
+				fat_device->SetSubtreePath(job.subtree_path);
+				TuneReading(fat_device.get() , job);
+				ofstream io_file(job.io_file_path.c_str());
+				if(!io_file.is_open()){
+					error_message = "The file \"" + job.io_file_path + "\" could not be opened.";
+					return false;
+				}
+				root_directory.reset(fat_device->ReadDirectoriesTree());
+				io_file << root_directory->ToXML();
+			}break;
+			case WRITE_DIRECTORIES_TREE:{
+				fat_device.reset(new FATDevice(final_device_path.c_str(), "r+" , job.direct_io));
+				fat_device->SetSnapshotCacheDirectory(job.snapshot_cache_directory);
+				fat_device->SetSubtreePath(job.subtree_path);
+				TuneReading(fat_device.get() , job);
+				fat_device->SetCompactDirectories(job.compact);
+				fat_device->SetDefragmentDirectories(job.defragment);
+				fat_device->SetPackingPolicy(job.packing_policy);
+				fat_device->SetRelocateFiles(job.relocate_files);
+				fat_device->SetDurabilityPolicy(job.durability_policy);
+				fat_device->SetEraseBlockSize(job.erase_block_size);
+				if(job.streaming){
+					StreamingSorter streaming_sorter(fat_device.get());
+					streaming_sorter.Sort(job.io_file_path.c_str());
+					break;
+				}
+				if(job.pipelined){
+					PipelinedSorter pipelined_sorter(fat_device.get());
+					pipelined_sorter.Sort(job.io_file_path.c_str());
+					break;
+				}
+				root_directory.reset(fat_device->ReadDirectoriesTree());
+				root_directory->ImportNewOrder(job.io_file_path.c_str());
+				if(!job.journal_path.empty()){
+					Journal journal(job.journal_path.c_str());
+					fat_device->WriteDirectoriesTree(root_directory.get() , &journal);
+				}else{
+					fat_device->WriteDirectoriesTree(root_directory.get());
+				}
+			}break;
+			case CREATE_WRITE_PLAN:{
+				WritePlan write_plan;
+				fat_device.reset(new FATDevice(final_device_path.c_str(), "r" , job.direct_io));
+				fat_device->SetSnapshotCacheDirectory(job.snapshot_cache_directory);
+				fat_device->SetSubtreePath(job.subtree_path);
+				TuneReading(fat_device.get() , job);
+				fat_device->SetCompactDirectories(job.compact);
+				fat_device->SetDefragmentDirectories(job.defragment);
+				fat_device->SetPackingPolicy(job.packing_policy);
+				root_directory.reset(fat_device->ReadDirectoriesTree());
+				root_directory->ImportNewOrder(job.io_file_path.c_str());
+				fat_device->CreateWritePlan(root_directory.get() , write_plan);
+				write_plan.Save(job.plan_path.c_str());
+				std::lock_guard<std::mutex> lock(output_mutex);
+				cout << "The plan has " << write_plan.GetBlocks().size() << " blocks." << endl;
+			}break;
+			case APPLY_WRITE_PLAN:{
+				WritePlan write_plan;
+				write_plan.Load(job.plan_path.c_str());
+				fat_device.reset(new FATDevice(final_device_path.c_str(), "r+" , job.direct_io));
+				fat_device->SetDurabilityPolicy(job.durability_policy);
+				fat_device->SetEraseBlockSize(job.erase_block_size);
+				if(!job.journal_path.empty()){
+					Journal journal(job.journal_path.c_str());
+					fat_device->ApplyWritePlan(write_plan , &journal);
+				}else{
+					fat_device->ApplyWritePlan(write_plan);
+				}
+			}break;
+			case CLONE_TO_TARGETS:{
+				WritePlan write_plan;
+				vector<string> targets;
+				if(!ReadTargets(job.targets_path.c_str() , targets)){
+					error_message = "The file \"" + job.targets_path + "\" could not be opened or is empty.";
+					return false;
+				}
+				fat_device.reset(new FATDevice(final_device_path.c_str(), "r" , job.direct_io));
+				fat_device->SetSnapshotCacheDirectory(job.snapshot_cache_directory);
+				fat_device->SetSubtreePath(job.subtree_path);
+				TuneReading(fat_device.get() , job);
+				fat_device->SetCompactDirectories(job.compact);
+				fat_device->SetDefragmentDirectories(job.defragment);
+				fat_device->SetPackingPolicy(job.packing_policy);
+				root_directory.reset(fat_device->ReadDirectoriesTree());
+				root_directory->ImportNewOrder(job.io_file_path.c_str());
+				/* All directory blocks are kept so they are verified on each target. */
+				fat_device->CreateWritePlan(root_directory.get() , write_plan , false);
+				root_directory.reset();
+				if(!CloneToTargets(write_plan , targets , job.direct_io , job.durability_policy ,
+					job.erase_block_size)){
+					error_message = "Some target devices could not be written.";
+					return false;
+				}
+			}break;
+			case ROLL_BACK_JOURNAL:{
+				Journal journal(job.journal_path.c_str());
+				journal.Load();
+				fat_device.reset(new FATDevice(final_device_path.c_str(), "r+" , job.direct_io));
+				fat_device->SetDurabilityPolicy(job.durability_policy);
+				fat_device->SetEraseBlockSize(job.erase_block_size);
+				fat_device->RollBack(journal);
+				std::lock_guard<std::mutex> lock(output_mutex);
+				cout << "The journal was rolled back (" << journal.GetBlocks().size() << " blocks)." << endl;
+			}break;
+			case FETCH_DEVICE_INFORMATION:{
+				fat_device.reset(new FATDevice(final_device_path.c_str(), "r" , job.direct_io));
+				string information = *fat_device;
+				std::lock_guard<std::mutex> lock(output_mutex);
+				cout << information;
+			}break;
+			case RUN_BATCH:
+			case RUN_DAEMON:
+			case INVALID_MODE:
+			break;
+		}
+	}catch(Exception e){
+		error_message = "Exception: " + string(e);
+		return false;
+	}
+	return true;
+}
+
+/* Reads the batch manifest. Each line has a device path, a file path and a mode ("r"
+	or "w") separated by tabs (or spaces if the line has no tab). Empty lines and lines
+	starting with '#' are ignored. The other fields of the jobs are copied from default_job. */
+bool ReadManifest(const char *manifest_path , const Job &default_job , vector<Job> &jobs ,
+	string &error_message){
+	ifstream manifest_file(manifest_path);
+	string line;
+	uint32 line_number = 0;
+
+	if(!manifest_file.is_open()){
+		error_message = string("The file \"") + manifest_path + "\" could not be opened.";
+		return false;
+	}
+	while(getline(manifest_file , line)){
+		vector<string> fields;
+		string field;
+		Job job = default_job;
+
+		line_number++;
+		if(!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+		if(line.empty() || line[0] == '#') continue;
+
+		if(line.find('\t') != string::npos){
+			stringstream line_stream(line);
+			while(getline(line_stream , field , '\t'))
+				if(!field.empty()) fields.push_back(field);
+		}else{
+			stringstream line_stream(line);
+			while(line_stream >> field) fields.push_back(field);
+		}
+
+		job.operation_mode = INVALID_MODE;
+		if(fields.size() == 3){
+			if(fields[2] == "r") job.operation_mode = READ_DIRECTORIES_TREE;
+			else if(fields[2] == "w") job.operation_mode = WRITE_DIRECTORIES_TREE;
+		}
+		if(job.operation_mode == INVALID_MODE){
+			stringstream buffer;
+			buffer << "The line " << line_number << " of the file \"" << manifest_path << "\" is invalid.";
+			error_message = buffer.str();
+			return false;
+		}
+		job.device_path = fields[0];
+		job.io_file_path = fields[1];
+		jobs.push_back(job);
+	}
+	if(jobs.empty()){
+		error_message = string("The file \"") + manifest_path + "\" has no jobs.";
+		return false;
+	}
+	return true;
+}
+
+/* The option that selects the operation mode of the job in the command line. */
+const char *GetOperationModeOption(OperationMode operation_mode){
+	switch(operation_mode){
+		case READ_DIRECTORIES_TREE:
+			return "r";
+		case CREATE_WRITE_PLAN:
+			return "n";
+		case APPLY_WRITE_PLAN:
+			return "a";
+		case CLONE_TO_TARGETS:
+			return "t";
+		case ROLL_BACK_JOURNAL:
+			return "u";
+		case FETCH_DEVICE_INFORMATION:
+			return "i";
+		default:
+			return "w";
+	}
+}
+
+/* Runs the jobs on a thread pool and writes a summary with the exit status and the
+	duration of each one in the report. If threads is zero, there is one thread per
+	processor. */
+bool RunJobs(const vector<Job> &jobs , ostream &report , uint32 threads = 0){
+	vector<string> errors(jobs.size());
+	vector<bool> succeeded(jobs.size());
+	vector<double> durations(jobs.size());
+	uint32 i , failures = 0;
+
+	{
+		ThreadPool thread_pool(threads);
+		for(i = 0 ; i < jobs.size() ; i++){
+			thread_pool.Submit([&jobs , &errors , &succeeded , &durations , i](){
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				succeeded[i] = RunJob(jobs[i] , errors[i]);
+				durations[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			});
+		}
+		thread_pool.Wait();
+	}
+
+	for(i = 0 ; i < jobs.size() ; i++){
+		report << "Job " << (i + 1) << " (\"" << jobs[i].device_path << "\" -" <<
+			GetOperationModeOption(jobs[i].operation_mode) << "): exit status " <<
+			(succeeded[i] ? 0 : 1) << ", " << fixed << setprecision(3) << durations[i] << " s";
+		if(!succeeded[i]){
+			report << ": " << errors[i];
+			failures++;
+		}
+		report << endl;
+	}
+	report << (jobs.size() - failures) << " of " << jobs.size() << " jobs succeeded." << endl;
+	return failures == 0;
+}
+
+/* If no partition was given and the device has more than one FAT partition, a job is
+	created for each one. The partition number is appended to the paths of the files of
+	these jobs, as in "tree.xml.2". Otherwise, jobs only has the job. With -T, threads is
+	the number of partitions that the device can process at once. */
+bool ExpandPartitionJobs(const Job &job , vector<Job> &jobs , uint32 &threads , string &error_message){
+	vector<PartitionTable::Partition> partitions , fat_partitions;
+	string final_device_path , path;
+	uint32 partition_number , i;
+	uint64 disk_size = 0;
+
+	jobs.assign(1 , job);
+	threads = 0;
+	if(job.operation_mode == CLONE_TO_TARGETS || !GetFinalDevicePath(job.device_path.c_str() ,
+		final_device_path)) return true;
+	PartitionTable::SplitDevicePath(final_device_path , path , partition_number);
+	if(partition_number != 0) return true;
+	try{
+		FileIO device_file(path.c_str() , "r" , false , job.direct_io);
+		if(!PartitionTable::Read(&device_file , partitions)) return true;
+		for(i = 0 ; i < partitions.size() ; i++){
+			disk_size = max(disk_size , partitions[i].offset + partitions[i].size);
+			if(partitions[i].fat) fat_partitions.push_back(partitions[i]);
+		}
+		if(job.auto_tune && fat_partitions.size() > 1)
+			threads = DeviceProbe::Tune(&device_file , disk_size , job.snapshot_cache_directory).threads;
+	}catch(Exception e){
+		error_message = "Exception: " + string(e);
+		return false;
+	}
+	if(fat_partitions.size() <= 1) return true;
+
+	jobs.clear();
+	for(i = 0 ; i < fat_partitions.size() ; i++){
+		stringstream number;
+		number << fat_partitions[i].number;
+		string suffix = "." + number.str();
+		jobs.push_back(job);
+		jobs.back().device_path = job.device_path + ":" + number.str();
+		if(!job.io_file_path.empty()) jobs.back().io_file_path += suffix;
+		if(!job.journal_path.empty()) jobs.back().journal_path += suffix;
+		if(!job.plan_path.empty()) jobs.back().plan_path += suffix;
+	}
+	return true;
+}
+
+/* Runs all the jobs of the manifest. Xerces is kept initialized, so the schema grammar
+	is compiled only once. */
+bool RunBatch(const char *manifest_path , const Job &default_job){
+	vector<Job> jobs;
+	string error_message;
+	bool success;
+
+	if(!ReadManifest(manifest_path , default_job , jobs , error_message)){
+		cerr << error_message << endl;
+		return false;
+	}
+
+	Xercesc::Initialize();
+	success = RunJobs(jobs , cout);
+	Xercesc::Terminate();
+	return success;
+}
+
+volatile sig_atomic_t stop_requested = 0;
+
+void RequestStop(int){
+	stop_requested = 1;
+}
+
+/* Renames a job file that could not be processed or removed to the ".failed" extension,
+	so it is not processed again. Returns false if it could not be renamed either. */
+bool SetJobFileAside(const string &job_file_path , const string &failed_file_path){
+	remove(failed_file_path.c_str());
+	if(rename(job_file_path.c_str() , failed_file_path.c_str())){
+		cerr << "The file \"" << job_file_path << "\" could not be renamed to \"" <<
+			failed_file_path << "\"." << endl;
+		return false;
+	}
+	cerr << "The file \"" << job_file_path << "\" was renamed to \"" << failed_file_path << "\"." << endl;
+	return true;
+}
+
+/* Processes a job file (a manifest) of the spool directory. The summary is written in a
+	result file with the same name and the job file is removed. Returns false if the job
+	file is still in the spool directory. */
+bool ProcessJobFile(const SpoolDirectory &spool_directory , const string &job_file ,
+	const Job &default_job){
+	string job_file_path = spool_directory.GetFilePath(job_file) , error_message;
+	string job_name = job_file.substr(0 , job_file.size() - strlen(SpoolDirectory::JOB_FILE_SUFFIX));
+	string result_file_path = spool_directory.GetFilePath(job_name + ".result");
+	string failed_file_path = spool_directory.GetFilePath(job_name + ".failed");
+	string temporary_result_file_path = result_file_path + ".tmp";
+	vector<Job> jobs;
+	bool success;
+
+	cout << "Processing \"" << job_file << "\"." << endl;
+	{
+		ofstream result_file(temporary_result_file_path.c_str());
+		if(!result_file.is_open()){
+			cerr << "The file \"" << temporary_result_file_path << "\" could not be created." << endl;
+			return SetJobFileAside(job_file_path , failed_file_path);
+		}
+		if(ReadManifest(job_file_path.c_str() , default_job , jobs , error_message)){
+			success = RunJobs(jobs , result_file);
+		}else{
+			result_file << error_message << endl;
+			success = false;
+		}
+		result_file << "Exit status " << (success ? 0 : 1) << "." << endl;
+	}
+
+	/* The result file appears only when it is complete. */
+	remove(result_file_path.c_str());
+	if(rename(temporary_result_file_path.c_str() , result_file_path.c_str()))
+		cerr << "The file \"" << result_file_path << "\" could not be created." << endl;
+	cout << "\"" << job_file << "\" finished with exit status " << (success ? 0 : 1) << "." << endl;
+	if(remove(job_file_path.c_str())){
+		cerr << "The file \"" << job_file_path << "\" could not be removed." << endl;
+		return SetJobFileAside(job_file_path , failed_file_path);
+	}
+	return true;
+}
+
+/* Processes the job files dropped in the spool directory until the program is
+	interrupted. Xerces and the schema grammar are loaded only once. */
+bool RunDaemon(const char *spool_path , const Job &default_job){
+	vector<string> job_files;
+	/* The job files that could neither be removed nor renamed are skipped while they stay
+		in the spool directory. */
+	set<string> stuck_job_files;
+	bool success = true;
+
+	signal(SIGINT , RequestStop);
+	signal(SIGTERM , RequestStop);
+	try{
+		SpoolDirectory spool_directory(spool_path);
+
+		Xercesc::Initialize();
+		try{
+			cout << "Waiting for job files in \"" << spool_path << "\"." << endl;
+			while(!stop_requested){
+				spool_directory.WaitForJobFiles(job_files , stuck_job_files , 1000);
+				for(uint32 i = 0 ; i < job_files.size() && !stop_requested ; i++){
+					if(!ProcessJobFile(spool_directory , job_files[i] , default_job))
+						stuck_job_files.insert(job_files[i]);
+				}
+			}
+		}catch(Exception e){
+			cerr << "Exception: " << e << endl;
+			success = false;
+		}
+		Xercesc::Terminate();
+	}catch(Exception e){
+		cerr << "Exception: " << e << endl;
+		return false;
+	}
+	return success;
+}
 
 int main(int argc , char **argv){
-	char *device_path = NULL, *io_file_path = NULL;
+	char *device_path = NULL, *io_file_path = NULL, *journal_path = NULL, *plan_path = NULL,
+		*targets_path = NULL, *manifest_path = NULL, *spool_path = NULL, *snapshot_cache_directory = NULL,
+		*subtree_path = NULL;
 	OperationMode operation_mode = INVALID_MODE;
+	bool streaming = false , pipelined = false , compact = false ,
+		defragment = false , relocate_files = false , direct_io = false ,
+		auto_tune = false;
+	uint32 scan_queue_depth = 0;
+	FATDevice::PackingPolicy packing_policy = FATDevice::PACK_NONE;
+	FATDevice::DurabilityPolicy durability_policy = FATDevice::DURABILITY_END;
+	bool durability_set = false;
+	uint32 erase_block_size = 0;
 
 	cout << "YAFS (Yet Another FAT Sorter) - version " << Version::VERSION << endl;
 
@@ -78,7 +742,7 @@ int main(int argc , char **argv){
 	
 	/* Parse the command line. */
 	{
-		CommandLineParser commandLineParser(argc , argv , string("d:?f:?r?w?i?h?v?").c_str());
+		CommandLineParser commandLineParser(argc , argv , string("d:?f:?r?w?i?h?v?c:?j:?u?n:?a:?t:?b:?s:?k:?p:?l?o?q:?m?g?x?y:?z?D:?e:?T?").c_str());
 
 		if (commandLineParser.isValid()) {
 			int exclusive_options_count = 0;
@@ -96,6 +760,35 @@ int main(int argc , char **argv){
 				exclusive_options_count++;
 				operation_mode = FETCH_DEVICE_INFORMATION;
 			}
+			if ((option = commandLineParser.getOption('u'))->found) {
+				exclusive_options_count++;
+				operation_mode = ROLL_BACK_JOURNAL;
+			}
+			if ((option = commandLineParser.getOption('n'))->found) {
+				exclusive_options_count++;
+				operation_mode = CREATE_WRITE_PLAN;
+				plan_path = option->argument_value;
+			}
+			if ((option = commandLineParser.getOption('a'))->found) {
+				exclusive_options_count++;
+				operation_mode = APPLY_WRITE_PLAN;
+				plan_path = option->argument_value;
+			}
+			if ((option = commandLineParser.getOption('t'))->found) {
+				exclusive_options_count++;
+				operation_mode = CLONE_TO_TARGETS;
+				targets_path = option->argument_value;
+			}
+			if ((option = commandLineParser.getOption('b'))->found) {
+				exclusive_options_count++;
+				operation_mode = RUN_BATCH;
+				manifest_path = option->argument_value;
+			}
+			if ((option = commandLineParser.getOption('s'))->found) {
+				exclusive_options_count++;
+				operation_mode = RUN_DAEMON;
+				spool_path = option->argument_value;
+			}
 			if ((option = commandLineParser.getOption('h'))->found) {
 				exclusive_options_count++;
 			}
@@ -123,9 +816,150 @@ int main(int argc , char **argv){
 				io_file_path = option->argument_value;
 			}
 
+			if ((option = commandLineParser.getOption('k'))->found) {
+				snapshot_cache_directory = option->argument_value;
+			}
+
+			if ((option = commandLineParser.getOption('p'))->found) {
+				subtree_path = option->argument_value;
+			}
+
+			if ((option = commandLineParser.getOption('l'))->found) {
+				streaming = true;
+			}
+
+			if ((option = commandLineParser.getOption('o'))->found) {
+				pipelined = true;
+			}
+
+			if ((option = commandLineParser.getOption('m'))->found) {
+				compact = true;
+			}
+
+			if ((option = commandLineParser.getOption('g'))->found) {
+				defragment = true;
+			}
+
+			if ((option = commandLineParser.getOption('x'))->found) {
+				relocate_files = true;
+			}
+
+			if ((option = commandLineParser.getOption('T'))->found) {
+				auto_tune = true;
+			}
+
+			if ((option = commandLineParser.getOption('z'))->found) {
+				direct_io = true;
+			}
+
+			if ((option = commandLineParser.getOption('y'))->found) {
+				if (strcmp(option->argument_value , "cluster") == 0) {
+					packing_policy = FATDevice::PACK_CLUSTERS;
+				} else if (strcmp(option->argument_value , "sector") == 0) {
+					packing_policy = FATDevice::PACK_SECTORS;
+				} else {
+					PrintErrorMessage();
+					return 1;
+				}
+			}
+
+			if ((option = commandLineParser.getOption('D'))->found) {
+				durability_set = true;
+				if (strcmp(option->argument_value , "none") == 0) {
+					durability_policy = FATDevice::DURABILITY_NONE;
+				} else if (strcmp(option->argument_value , "end") == 0) {
+					durability_policy = FATDevice::DURABILITY_END;
+				} else if (strcmp(option->argument_value , "ordered") == 0) {
+					durability_policy = FATDevice::DURABILITY_ORDERED;
+				} else {
+					PrintErrorMessage();
+					return 1;
+				}
+			}
+
+			if ((option = commandLineParser.getOption('e'))->found) {
+				if (strcmp(option->argument_value , "auto") == 0) {
+					erase_block_size = FATDevice::PROBE_ERASE_BLOCK_SIZE;
+				} else {
+					char *end;
+					unsigned long long value = strtoull(option->argument_value , &end , 10);
+					if (*end == 'K' || *end == 'k') {
+						value *= 1024;
+						end++;
+					} else if (*end == 'M' || *end == 'm') {
+						value *= 1024 * 1024;
+						end++;
+					}
+					/* The erase blocks are made of whole sectors and are read into memory. */
+					if (*option->argument_value == '\0' || *end != '\0' || value == 0 || value % 512 != 0
+							|| value > 256 * 1024 * 1024) {
+						PrintErrorMessage();
+						return 1;
+					}
+					erase_block_size = (uint32)value;
+				}
+			}
+
+			if ((option = commandLineParser.getOption('q'))->found) {
+				char *end;
+				unsigned long value = strtoul(option->argument_value , &end , 10);
+				if (*option->argument_value == '\0' || *end != '\0' || value == 0 || value > 65536) {
+					PrintErrorMessage();
+					return 1;
+				}
+				scan_queue_depth = (uint32)value;
+			}
+
+			if ((option = commandLineParser.getOption('j'))->found) {
+				journal_path = option->argument_value;
+			}
+
+			if ((option = commandLineParser.getOption('c'))->found) {
+				Unicode::CodePage code_page;
+				if (!Unicode::GetCodePageByName(option->argument_value, code_page)) {
+					PrintErrorMessage();
+					return 1;
+				}
+				Unicode::SetCodePage(code_page);
+			}
+
 			assert (operation_mode != INVALID_MODE);
-			if (device_path == NULL
-					|| (io_file_path == NULL && operation_mode != FETCH_DEVICE_INFORMATION)) {
+			/* The batch and daemon modes take the devices and files from the job files. */
+			bool runs_job_files = operation_mode == RUN_BATCH || operation_mode == RUN_DAEMON;
+			if ((device_path == NULL && !runs_job_files)
+					|| (device_path != NULL && runs_job_files)
+					|| (io_file_path != NULL && runs_job_files)
+					|| (io_file_path == NULL && !runs_job_files && operation_mode != FETCH_DEVICE_INFORMATION
+						&& operation_mode != ROLL_BACK_JOURNAL && operation_mode != APPLY_WRITE_PLAN)
+					|| (subtree_path != NULL && operation_mode != READ_DIRECTORIES_TREE
+						&& operation_mode != WRITE_DIRECTORIES_TREE && operation_mode != CREATE_WRITE_PLAN
+						&& operation_mode != CLONE_TO_TARGETS)
+					|| (streaming && operation_mode != WRITE_DIRECTORIES_TREE && operation_mode != RUN_BATCH
+						&& operation_mode != RUN_DAEMON)
+					|| (streaming && journal_path != NULL)
+					|| (pipelined && operation_mode != WRITE_DIRECTORIES_TREE && operation_mode != RUN_BATCH
+						&& operation_mode != RUN_DAEMON)
+					|| (pipelined && (journal_path != NULL || streaming))
+					|| (compact && (operation_mode == READ_DIRECTORIES_TREE || operation_mode == FETCH_DEVICE_INFORMATION
+						|| operation_mode == ROLL_BACK_JOURNAL || operation_mode == APPLY_WRITE_PLAN))
+					|| (defragment && (streaming || pipelined || operation_mode == READ_DIRECTORIES_TREE
+						|| operation_mode == FETCH_DEVICE_INFORMATION || operation_mode == ROLL_BACK_JOURNAL
+						|| operation_mode == APPLY_WRITE_PLAN))
+					|| (relocate_files && (streaming || pipelined || (operation_mode != WRITE_DIRECTORIES_TREE
+						&& operation_mode != RUN_BATCH && operation_mode != RUN_DAEMON)))
+					|| (packing_policy != FATDevice::PACK_NONE && (operation_mode == READ_DIRECTORIES_TREE
+						|| operation_mode == FETCH_DEVICE_INFORMATION || operation_mode == ROLL_BACK_JOURNAL
+						|| operation_mode == APPLY_WRITE_PLAN))
+					|| ((durability_set || erase_block_size != 0) && (operation_mode == READ_DIRECTORIES_TREE
+						|| operation_mode == FETCH_DEVICE_INFORMATION || operation_mode == CREATE_WRITE_PLAN))
+					|| (scan_queue_depth > 0 && (streaming || pipelined))
+					|| ((scan_queue_depth > 0 || auto_tune) && (operation_mode == FETCH_DEVICE_INFORMATION
+						|| operation_mode == ROLL_BACK_JOURNAL || operation_mode == APPLY_WRITE_PLAN))
+					|| (journal_path == NULL && operation_mode == ROLL_BACK_JOURNAL)
+					|| (journal_path != NULL && durability_policy == FATDevice::DURABILITY_NONE
+						&& operation_mode != ROLL_BACK_JOURNAL)
+					|| (journal_path != NULL && operation_mode != WRITE_DIRECTORIES_TREE
+						&& operation_mode != ROLL_BACK_JOURNAL && operation_mode != APPLY_WRITE_PLAN)) {
 				PrintErrorMessage();
 				return 1;
 			}
@@ -136,56 +970,52 @@ int main(int argc , char **argv){
 		}
 	}
 
-	FATDevice *fat_device = NULL;
-   try{
-		char *final_device_path;
-		RootDirectory *root_directory;
-
-		#ifdef WIN_SYSTEM
-			if(strlen(device_path) != 2 || device_path[1] != ':'){
-				PrintErrorMessage();
-				return 1;
-			}
-			final_device_path = new char[7];
-			memcpy(final_device_path , "\\\\.\\?:" , 7);
-			final_device_path[4] = device_path[0];
-		#elif UNIX_SYSTEM
-			final_device_path = device_path;
-		#endif
+	Job job;
+	job.operation_mode = operation_mode;
+	if (device_path != NULL) job.device_path = device_path;
+	if (io_file_path != NULL) job.io_file_path = io_file_path;
+	if (journal_path != NULL) job.journal_path = journal_path;
+	if (plan_path != NULL) job.plan_path = plan_path;
+	if (targets_path != NULL) job.targets_path = targets_path;
+	if (snapshot_cache_directory != NULL) job.snapshot_cache_directory = snapshot_cache_directory;
+	if (subtree_path != NULL) job.subtree_path = subtree_path;
+	job.streaming = streaming;
+	job.pipelined = pipelined;
+	job.scan_queue_depth = scan_queue_depth;
+	job.compact = compact;
+	job.defragment = defragment;
+	job.relocate_files = relocate_files;
+	job.packing_policy = packing_policy;
+	job.direct_io = direct_io;
+	job.durability_policy = durability_policy;
+	job.erase_block_size = erase_block_size;
+	job.auto_tune = auto_tune;
 
-		switch(operation_mode){
-			case READ_DIRECTORIES_TREE:{
-				fat_device = new FATDevice(final_device_path, "r");
-				ofstream io_file(io_file_path);
-				if(!io_file.is_open()){
-					cerr << "The file \"" << io_file_path << "\" could not be opened." << endl;
-					return 1;
-				}
-				root_directory = fat_device->ReadDirectoriesTree();
-				io_file << root_directory->ToXML();
-				delete root_directory;
-			}break;
-			case WRITE_DIRECTORIES_TREE:{
-				fat_device = new FATDevice(final_device_path, "r+");
-				root_directory = fat_device->ReadDirectoriesTree();
-				root_directory->ImportNewOrder(io_file_path);
-				fat_device->WriteDirectoriesTree(root_directory);
-				delete root_directory;
-			}break;
-			case FETCH_DEVICE_INFORMATION:{
-				fat_device = new FATDevice(final_device_path, "r");
-				cout << *fat_device;
-			}break;
-			case INVALID_MODE:
-			break;
-		}
-   }catch(Exception e){
-     cerr << "Exception: " << e << endl;
-	  return 1;
-   }
+	/* The job has the options that are shared by all the jobs of the job files. */
+	if (operation_mode == RUN_BATCH) {
+		return RunBatch(manifest_path , job) ? 0 : 1;
+	}
+	if (operation_mode == RUN_DAEMON) {
+		return RunDaemon(spool_path , job) ? 0 : 1;
+	}
 
-   if (fat_device != NULL) {
-		delete fat_device;
+	string error_message;
+	vector<Job> jobs;
+	uint32 threads;
+	if (!ExpandPartitionJobs(job , jobs , threads , error_message)) {
+		cerr << error_message << endl;
+		return 1;
+	}
+	/* The partitions are sorted at the same time, each one by its own FATDevice. */
+	if (jobs.size() > 1) {
+		Xercesc::Initialize();
+		bool success = RunJobs(jobs , cout , threads);
+		Xercesc::Terminate();
+		return success ? 0 : 1;
+	}
+	if (!RunJob(job , error_message)) {
+		cerr << error_message << endl;
+		return 1;
 	}
 
    return 0;
@@ -0,0 +1,271 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checksum.h"
+#include "fat.h"
+#include "pack.h"
+#include "partition_table.h"
+#include "types.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+
+#define MBR_SIGNATURE_OFFSET 510
+#define MBR_PARTITIONS_OFFSET 446
+#define MBR_PARTITIONS 4
+#define MBR_TYPE_EMPTY 0x00
+#define MBR_TYPE_GPT_PROTECTIVE 0xEE
+/* The EBRs of the logical partitions are chained, a loop must not be followed forever. */
+#define MAX_LOGICAL_PARTITIONS 128
+
+#define GPT_SIGNATURE "EFI PART"
+#define MAX_GPT_ENTRIES 1024
+/* The offset of header_crc32, which is zero while the header CRC is computed. */
+#define GPT_HEADER_CRC32_OFFSET 16
+
+PACK(struct MBRPartitionEntry{
+	uint8 status;
+	uint8 first_chs[3];
+	uint8 type;
+	uint8 last_chs[3];
+	uint32 first_lba;
+	uint32 sectors;
+});
+#ifndef __APPLE__
+	static_assert(sizeof(MBRPartitionEntry) == 16, "Expecting MBRPartitionEntry with 16 bytes length");
+#endif
+
+PACK(struct GPTHeader{
+	uint8 signature[8];
+	uint32 revision;
+	uint32 header_size;
+	uint32 header_crc32;
+	uint32 reserved;
+	uint64 current_lba;
+	uint64 backup_lba;
+	uint64 first_usable_lba;
+	uint64 last_usable_lba;
+	uint8 disk_guid[16];
+	uint64 partition_entries_lba;
+	uint32 number_of_partition_entries;
+	uint32 size_of_partition_entry;
+	uint32 partition_entries_crc32;
+});
+#ifndef __APPLE__
+	static_assert(sizeof(GPTHeader) == 92, "Expecting GPTHeader with 92 bytes length");
+#endif
+
+PACK(struct GPTPartitionEntry{
+	uint8 type_guid[16];
+	uint8 partition_guid[16];
+	uint64 first_lba;
+	uint64 last_lba;
+	uint64 attributes;
+	uint16 name[36];
+});
+#ifndef __APPLE__
+	static_assert(sizeof(GPTPartitionEntry) == 128, "Expecting GPTPartitionEntry with 128 bytes length");
+#endif
+
+/* The GUIDs as they are stored: the first three fields are little endian. */
+static const uint8 GPT_TYPE_BASIC_DATA[16] = {0xA2 , 0xA0 , 0xD0 , 0xEB , 0xE5 , 0xB9 , 0x33 , 0x44 ,
+	0x87 , 0xC0 , 0x68 , 0xB6 , 0xB7 , 0x26 , 0x99 , 0xC7};
+static const uint8 GPT_TYPE_EFI_SYSTEM[16] = {0x28 , 0x73 , 0x2A , 0xC1 , 0x1F , 0xF8 , 0xD2 , 0x11 ,
+	0xBA , 0x4B , 0x00 , 0xA0 , 0xC9 , 0x3E , 0xC9 , 0x3B};
+
+static bool IsExtendedType(uint8 type){
+	return type == 0x05 || type == 0x0F || type == 0x85;
+}
+
+/* FAT12, FAT16 and FAT32 types, the hidden ones and the EFI system partition. */
+static bool IsFATType(uint8 type){
+	switch(type){
+		case 0x01: case 0x04: case 0x06: case 0x0B: case 0x0C: case 0x0E:
+		case 0x11: case 0x14: case 0x16: case 0x1B: case 0x1C: case 0x1E:
+		case 0xEF:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool IsPowerOfTwo(uint32 value){
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+bool PartitionTable::IsFATBootSector(const uint8 *sector){
+	BootSectorBIOSParameterBlock bs_bpb;
+
+	memcpy(&bs_bpb , sector , sizeof(BootSectorBIOSParameterBlock));
+	/* NTFS and exFAT have no FATs or reserved sectors in this BPB. */
+	return (bs_bpb.BS_jmpBoot[0] == 0xEB || bs_bpb.BS_jmpBoot[0] == 0xE9) &&
+		IsPowerOfTwo(bs_bpb.BPB_BytsPerSec) && bs_bpb.BPB_BytsPerSec >= 512 && bs_bpb.BPB_BytsPerSec <= 4096 &&
+		IsPowerOfTwo(bs_bpb.BPB_SecPerClus) && bs_bpb.BPB_RsvdSecCnt > 0 && bs_bpb.BPB_NumFATs > 0;
+}
+
+bool PartitionTable::IsFATPartition(FileIO *file , uint64 offset){
+	uint8 sector[512];
+
+	/* A partition that starts after the end of the image is not used. */
+	try{
+		file->Read(sector , sizeof(sector) , offset);
+	}catch(FileIO::FileIOException f_io_exception){
+		return false;
+	}
+	return IsFATBootSector(sector);
+}
+
+void PartitionTable::SplitDevicePath(const string &device_path , string &path ,
+	uint32 &partition_number){
+	string::size_type separator = device_path.rfind(':');
+	FILE *file;
+
+	path = device_path;
+	partition_number = 0;
+	if(separator == string::npos || separator == 0 || separator + 1 == device_path.size() ||
+		device_path.find_first_not_of("0123456789" , separator + 1) != string::npos) return;
+	/* A file whose name ends with ":N" is still opened. */
+	if((file = fopen(device_path.c_str() , "rb")) != NULL){
+		fclose(file);
+		return;
+	}
+	path = device_path.substr(0 , separator);
+	partition_number = (uint32)strtoul(device_path.c_str() + separator + 1 , NULL , 10);
+}
+
+bool PartitionTable::Read(FileIO *file , vector<Partition> &partitions){
+	uint8 sector[512];
+	MBRPartitionEntry entry;
+
+	partitions.clear();
+	file->Read(sector , sizeof(sector) , 0);
+	/* A FAT volume without partitions also ends its first sector with the signature. */
+	if(sector[MBR_SIGNATURE_OFFSET] != 0x55 || sector[MBR_SIGNATURE_OFFSET + 1] != 0xAA ||
+		IsFATBootSector(sector)) return false;
+
+	for(uint32 i = 0 ; i < MBR_PARTITIONS ; i++){
+		memcpy(&entry , sector + MBR_PARTITIONS_OFFSET + i * sizeof(MBRPartitionEntry) ,
+			sizeof(MBRPartitionEntry));
+		if(entry.type == MBR_TYPE_GPT_PROTECTIVE){
+			/* The GPT is in the second logical sector. */
+			if(ReadGPT(file , 512 , partitions) || ReadGPT(file , 4096 , partitions)) return true;
+			throw PartitionTableException("The GPT is invalid.");
+		}
+	}
+	ReadMBR(file , sector , partitions);
+	return true;
+}
+
+void PartitionTable::ReadMBR(FileIO *file , const uint8 *sector , vector<Partition> &partitions){
+	MBRPartitionEntry entry;
+	Partition partition;
+
+	for(uint32 i = 0 ; i < MBR_PARTITIONS ; i++){
+		memcpy(&entry , sector + MBR_PARTITIONS_OFFSET + i * sizeof(MBRPartitionEntry) ,
+			sizeof(MBRPartitionEntry));
+		if(entry.status != 0x00 && entry.status != 0x80)
+			throw PartitionTableException("The MBR is invalid.");
+		if(entry.type == MBR_TYPE_EMPTY || entry.sectors == 0) continue;
+		if(IsExtendedType(entry.type)){
+			ReadExtendedPartitions(file , uint64(entry.first_lba) * 512 , partitions);
+			continue;
+		}
+		partition.number = i + 1;
+		partition.offset = uint64(entry.first_lba) * 512;
+		partition.size = uint64(entry.sectors) * 512;
+		partition.fat = IsFATType(entry.type) && IsFATPartition(file , partition.offset);
+		partitions.push_back(partition);
+	}
+}
+
+void PartitionTable::ReadExtendedPartitions(FileIO *file , uint64 extended_start ,
+	vector<Partition> &partitions){
+	uint8 sector[512];
+	MBRPartitionEntry logical , next;
+	Partition partition;
+	uint64 ebr_offset = extended_start;
+
+	/* Each EBR has the logical partition, relative to the EBR, and the next EBR,
+		relative to the extended partition. */
+	for(uint32 number = 5 ; number < 5 + MAX_LOGICAL_PARTITIONS ; number++){
+		try{
+			file->Read(sector , sizeof(sector) , ebr_offset);
+		}catch(FileIO::FileIOException f_io_exception){
+			throw PartitionTableException("The extended partition is invalid.");
+		}
+		if(sector[MBR_SIGNATURE_OFFSET] != 0x55 || sector[MBR_SIGNATURE_OFFSET + 1] != 0xAA)
+			throw PartitionTableException("The extended partition is invalid.");
+		memcpy(&logical , sector + MBR_PARTITIONS_OFFSET , sizeof(MBRPartitionEntry));
+		memcpy(&next , sector + MBR_PARTITIONS_OFFSET + sizeof(MBRPartitionEntry) , sizeof(MBRPartitionEntry));
+		if(logical.type != MBR_TYPE_EMPTY && logical.sectors != 0){
+			partition.number = number;
+			partition.offset = ebr_offset + uint64(logical.first_lba) * 512;
+			partition.size = uint64(logical.sectors) * 512;
+			partition.fat = IsFATType(logical.type) && IsFATPartition(file , partition.offset);
+			partitions.push_back(partition);
+		}
+		if(!IsExtendedType(next.type) || next.first_lba == 0) return;
+		ebr_offset = extended_start + uint64(next.first_lba) * 512;
+	}
+	throw PartitionTableException("The extended partition has too many logical partitions.");
+}
+
+bool PartitionTable::ReadGPT(FileIO *file , uint32 sector_size , vector<Partition> &partitions){
+	vector<uint8> sector(sector_size) , entries;
+	GPTHeader header;
+	GPTPartitionEntry entry;
+	Partition partition;
+	uint64 first_lba , last_lba;
+
+	/* The header and the entries must be inside the image and match their CRCs. */
+	try{
+		file->Read(sector.data() , sector_size , sector_size);
+		memcpy(&header , sector.data() , sizeof(GPTHeader));
+		if(memcmp(header.signature , GPT_SIGNATURE , sizeof(header.signature)) != 0) return false;
+		if(header.header_size < sizeof(GPTHeader) || header.header_size > sector_size ||
+			header.size_of_partition_entry != sizeof(GPTPartitionEntry) ||
+			header.number_of_partition_entries > MAX_GPT_ENTRIES) return false;
+		memset(sector.data() + GPT_HEADER_CRC32_OFFSET , 0 , sizeof(header.header_crc32));
+		if(Checksum::CRC32(sector.data() , header.header_size) != header.header_crc32) return false;
+
+		entries.resize(header.number_of_partition_entries * sizeof(GPTPartitionEntry));
+		file->Read(entries.data() , (uint32)entries.size() , header.partition_entries_lba * sector_size);
+		if(Checksum::CRC32(entries.data() , entries.size()) != header.partition_entries_crc32) return false;
+	}catch(FileIO::FileIOException f_io_exception){
+		return false;
+	}
+	for(uint32 i = 0 ; i < header.number_of_partition_entries ; i++){
+		memcpy(&entry , entries.data() + i * sizeof(GPTPartitionEntry) , sizeof(GPTPartitionEntry));
+		first_lba = entry.first_lba;
+		last_lba = entry.last_lba;
+		if(first_lba == 0 || last_lba < first_lba) continue;
+		partition.number = i + 1;
+		partition.offset = first_lba * sector_size;
+		partition.size = (last_lba - first_lba + 1) * sector_size;
+		/* The basic data type is shared with NTFS and exFAT, so the boot sector is checked. */
+		partition.fat = (memcmp(entry.type_guid , GPT_TYPE_BASIC_DATA , 16) == 0 ||
+			memcmp(entry.type_guid , GPT_TYPE_EFI_SYSTEM , 16) == 0) &&
+			IsFATPartition(file , partition.offset);
+		partitions.push_back(partition);
+	}
+	return true;
+}
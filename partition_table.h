@@ -0,0 +1,70 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Partition Table Module: finds the partitions of a disk image with a MBR or a GPT.
+ */
+
+#ifndef YAFS_PARTITION_TABLE_H
+	#define YAFS_PARTITION_TABLE_H
+
+	#include "exception.h"
+	#include "file_io.h"
+	#include "types.h"
+
+	#include <string>
+	#include <vector>
+
+	using namespace std;
+
+	class PartitionTable {
+		public:
+			struct Partition {
+				/* The MBR primary partitions are numbered from 1 to 4 and the logical ones
+					from 5. The GPT partitions have the number of their entry. */
+				uint32 number;
+				uint64 offset , size;
+				/* If the partition type is a FAT one and it has a FAT boot sector. */
+				bool fat;
+			};
+
+			/* Reads the MBR or the GPT of the file. Returns false if the file has no
+				partition table, like a FAT volume that starts at its first sector. */
+			static bool Read(FileIO *file , vector<Partition> &partitions);
+			/* Splits a path like "image.img:2" in the file path and the partition number.
+				The partition number is zero if the path has none. */
+			static void SplitDevicePath(const string &device_path , string &path ,
+				uint32 &partition_number);
+			/* Checks the fields of the boot sector that every FAT volume has. */
+			static bool IsFATBootSector(const uint8 *sector);
+
+			class PartitionTableException : public Exception {
+				public:
+					PartitionTableException(string message = ""):Exception(message){}
+			};
+
+		private:
+			static void ReadMBR(FileIO *file , const uint8 *sector , vector<Partition> &partitions);
+			static void ReadExtendedPartitions(FileIO *file , uint64 extended_start ,
+				vector<Partition> &partitions);
+			static bool ReadGPT(FileIO *file , uint32 sector_size , vector<Partition> &partitions);
+			static bool IsFATPartition(FileIO *file , uint64 offset);
+	};
+
+#endif
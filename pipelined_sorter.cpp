@@ -0,0 +1,169 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pipelined_sorter.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include "xercesc.h"
+
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+PipelinedSorter::PipelinedSorter(FATDevice *fat_device):read_queue(QUEUE_CAPACITY) ,
+	sorted_queue(QUEUE_CAPACITY) , stopping(false){
+	this->fat_device = fat_device;
+	read_directories = serialized_directories = 0;
+}
+
+void PipelinedSorter::Stop(){
+	stopping = true;
+	read_queue.WakeUpAll();
+	sorted_queue.WakeUpAll();
+}
+
+void PipelinedSorter::Sort(const char *xml_file){
+	std::chrono::steady_clock::time_point start;
+	double pipeline_seconds , write_seconds;
+
+	Xercesc::Initialize();
+
+	try{
+		std::unique_ptr<XercesDOMParser> parser(RootDirectory::ParseInputFile(xml_file));
+		DOMElement *root_element = parser->getDocument()->getDocumentElement();
+
+		start = std::chrono::steady_clock::now();
+		RunPipeline(root_element);
+		pipeline_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		/* Every directory matched the input file, so the blocks can be written. */
+		start = std::chrono::steady_clock::now();
+		fat_device->WriteSerializedBlocks(blocks);
+		write_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}catch(...){
+		blocks.clear();
+		root_directory.reset();
+		Xercesc::Terminate();
+		throw;
+	}
+	blocks.clear();
+	root_directory.reset();
+	Xercesc::Terminate();
+
+	if(LogUtils::IsEnabled()){
+		ostringstream pipeline_text , write_text;
+
+		pipeline_text << fixed << setprecision(3) << pipeline_seconds;
+		write_text << fixed << setprecision(3) << write_seconds;
+		LogUtils::Debug() << read_directories << " directories were read and " <<
+			serialized_directories << " were written." << endl;
+		LogUtils::Debug() << "The directories were read, sorted and serialized in " << pipeline_text.str() <<
+			" s and written in " << write_text.str() << " s." << endl;
+	}
+}
+
+void PipelinedSorter::RunPipeline(DOMElement *root_element){
+	ThreadPool thread_pool(3);
+
+	stopping = false;
+	read_directories = serialized_directories = 0;
+	blocks.clear();
+	root_directory.reset(fat_device->ReadRootDirectory());
+	/* A failed stage stops the others before its exception is rethrown by Wait. */
+	thread_pool.Submit([this](){
+		try{ ReadStage(); }catch(...){ Stop(); throw; }
+	});
+	thread_pool.Submit([this , root_element](){
+		try{ SortStage(root_element); }catch(...){ Stop(); throw; }
+	});
+	thread_pool.Submit([this](){
+		try{ SerializeStage(); }catch(...){ Stop(); throw; }
+	});
+	thread_pool.Wait();
+}
+
+void PipelinedSorter::ReadStage(){
+	vector<FATDirectory*> pending_directories;
+	Item item;
+
+	/* The subdirectories are taken before the directory is passed on because the next
+		stage sorts its content. */
+	root_directory->GetSubdirectories(pending_directories);
+	item.fat_directory = NULL;
+	item.root_directory = root_directory.get();
+	read_directories++;
+	if(!read_queue.Push(item , stopping)) return;
+
+	/* A parent is always passed on before its subdirectories. */
+	while(!pending_directories.empty()){
+		FATDirectory *fat_directory = pending_directories.back();
+		pending_directories.pop_back();
+		fat_device->ReadDirectoryContent(fat_directory);
+		fat_directory->GetSubdirectories(pending_directories);
+		item.fat_directory = fat_directory;
+		item.root_directory = NULL;
+		read_directories++;
+		if(!read_queue.Push(item , stopping)) return;
+	}
+
+	item.fat_directory = NULL;
+	item.root_directory = NULL;
+	read_queue.Push(item , stopping);
+}
+
+void PipelinedSorter::SortStage(DOMElement *root_element){
+	/* The elements of the directories whose parents were already sorted. */
+	map<FATDirectory* , DOMElement*> directory_elements;
+	vector<pair<FATDirectory* , DOMElement*> > subdirectories;
+	Item item;
+
+	while(read_queue.Pop(item , stopping)){
+		subdirectories.clear();
+		if(item.root_directory != NULL){
+			item.root_directory->ReorderContent(root_element , subdirectories);
+		}else if(item.fat_directory != NULL){
+			map<FATDirectory* , DOMElement*>::iterator iterator = directory_elements.find(item.fat_directory);
+			if(iterator == directory_elements.end()) ThrowDoNotMatchException();
+			item.fat_directory->ReorderContent(iterator->second , subdirectories);
+			directory_elements.erase(iterator);
+		}
+		directory_elements.insert(subdirectories.begin() , subdirectories.end());
+
+		if(!sorted_queue.Push(item , stopping)) return;
+		if(item.fat_directory == NULL && item.root_directory == NULL) return;
+	}
+}
+
+void PipelinedSorter::SerializeStage(){
+	Item item;
+
+	while(sorted_queue.Pop(item , stopping)){
+		if(item.fat_directory == NULL && item.root_directory == NULL) return;
+		if(item.root_directory != NULL){
+			fat_device->SerializeDirectoriesTree(item.root_directory , blocks , false);
+		}else{
+			fat_device->SerializeDirectoryContent(item.fat_directory , blocks);
+		}
+		serialized_directories++;
+	}
+}
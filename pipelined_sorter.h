@@ -0,0 +1,79 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Pipelined Sorter Module: sorts a device with three threads, one reading the directories,
+ * one applying the order of the input file and one serializing the sorted directories.
+ */
+
+#ifndef YAFS_PIPELINED_SORTER_H
+	#define YAFS_PIPELINED_SORTER_H
+
+	#include "fat_device.h"
+	#include "fat_elements.h"
+	#include "spsc_queue.h"
+	#include "types.h"
+
+	#include <atomic>
+	#include <memory>
+	#include <vector>
+	/* Xerces includes: */
+	#include <xercesc/dom/DOM.hpp>
+	XERCES_CPP_NAMESPACE_USE
+
+	class PipelinedSorter {
+		public:
+			PipelinedSorter(FATDevice *fat_device);
+
+			/* The result is the same of RootDirectory::ImportNewOrder followed by
+				FATDevice::WriteDirectoriesTree, but the directories are serialized while the
+				others are read and sorted. The blocks are only written after the whole
+				input file matched the device, so nothing is written if some directory does
+				not match. */
+			void Sort(const char *xml_file);
+
+		private:
+			/* The number of directories each queue holds. */
+			static const uint32 QUEUE_CAPACITY = 64;
+
+			/* A directory passed between the stages. The root directory has
+				fat_directory equal to NULL and the last item has both NULL. */
+			struct Item {
+				FATDirectory *fat_directory;
+				RootDirectory *root_directory;
+			};
+
+			FATDevice *fat_device;
+			std::unique_ptr<RootDirectory> root_directory;
+			SPSCQueue<Item> read_queue , sorted_queue;
+			/* Set when a stage fails, so the others stop waiting. */
+			std::atomic<bool> stopping;
+			/* The blocks of the sorted directories, written when the pipeline ends. */
+			vector<DeviceBlock> blocks;
+			uint32 read_directories , serialized_directories;
+
+			void RunPipeline(DOMElement *root_element);
+			void ReadStage();
+			void SortStage(DOMElement *root_element);
+			void SerializeStage();
+			/* Sets stopping and wakes up the stages waiting on the queues. */
+			void Stop();
+	};
+
+#endif
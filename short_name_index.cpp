@@ -0,0 +1,96 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "short_name_index.h"
+#include "types.h"
+
+#include <cstring>
+
+/* It must be a power of two. */
+#define SHORT_NAME_INDEX_INITIAL_CAPACITY 16U
+
+ShortNameIndex::ShortNameIndex(){
+	slots = NULL;
+	capacity = count = 0;
+}
+
+ShortNameIndex::~ShortNameIndex(){
+	delete[] slots;
+}
+
+ShortNameIndex::Key ShortNameIndex::MakeKey(const uint8 *dir_name){
+	uint8 name[16];
+	uint32 i;
+	Key key;
+
+	memset(name , ' ' , sizeof(name));
+	/* Only the characters before the first space of the name and of the extension
+		are part of the short name, so the remaining ones are ignored. */
+	for(i = 0 ; i < 8 && dir_name[i] != ' ' ; i++)
+		name[i] = dir_name[i];
+	for(i = 8 ; i < 11 && dir_name[i] != ' ' ; i++)
+		name[i] = dir_name[i];
+
+	memcpy(&key.first , name , sizeof(uint64));
+	memcpy(&key.second , name + sizeof(uint64) , sizeof(uint64));
+	return key;
+}
+
+uint32 ShortNameIndex::FindSlot(const Key &key) const{
+	uint64 hash = (key.first * 0x9E3779B97F4A7C15ULL) ^ (key.second * 0xC2B2AE3D27D4EB4FULL);
+	uint32 i = (uint32)(hash >> 32) & (capacity - 1);
+
+	/* Linear probing: the load factor is kept below 1/2 so there is always an empty slot. */
+	while(slots[i].fat_element != NULL &&
+		(slots[i].key.first != key.first || slots[i].key.second != key.second))
+		i = (i + 1) & (capacity - 1);
+	return i;
+}
+
+void ShortNameIndex::Grow(){
+	Slot *old_slots = slots;
+	uint32 old_capacity = capacity , i;
+
+	capacity = capacity == 0 ? SHORT_NAME_INDEX_INITIAL_CAPACITY : capacity * 2;
+	slots = new Slot[capacity];
+	memset(slots , 0 , sizeof(Slot) * capacity);
+	for(i = 0 ; i < old_capacity ; i++){
+		if(old_slots[i].fat_element != NULL)
+			slots[FindSlot(old_slots[i].key)] = old_slots[i];
+	}
+	delete[] old_slots;
+}
+
+bool ShortNameIndex::Insert(const uint8 *dir_name , FATElement *fat_element){
+	Key key = MakeKey(dir_name);
+	uint32 i;
+
+	if((count + 1) * 2 > capacity) Grow();
+	i = FindSlot(key);
+	if(slots[i].fat_element != NULL) return false;
+	slots[i].key = key;
+	slots[i].fat_element = fat_element;
+	count++;
+	return true;
+}
+
+FATElement* ShortNameIndex::Find(const uint8 *dir_name) const{
+	if(count == 0) return NULL;
+	return slots[FindSlot(MakeKey(dir_name))].fat_element;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Short Name Index Module: an open addressing hash table that indexes the FAT elements of a
+ * directory by their 11 bytes short name (DIR_Name).
+ */
+
+#ifndef YAFS_SHORT_NAME_INDEX_H
+	#define YAFS_SHORT_NAME_INDEX_H
+
+	#include "types.h"
+
+	class FATElement;
+
+	class ShortNameIndex {
+		public:
+			ShortNameIndex();
+			~ShortNameIndex();
+
+			/* Returns false if there is already an element with the same name. */
+			bool Insert(const uint8 *dir_name , FATElement *fat_element);
+			FATElement* Find(const uint8 *dir_name) const;
+
+		private:
+			ShortNameIndex(const ShortNameIndex&);
+			ShortNameIndex& operator=(const ShortNameIndex&);
+
+			/* The 11 bytes packed into two machine words. */
+			struct Key {
+				uint64 first;
+				uint64 second;
+			};
+			struct Slot {
+				Key key;
+				FATElement *fat_element;
+			};
+
+			Slot *slots;
+			uint32 capacity , count;
+
+			static Key MakeKey(const uint8 *dir_name);
+			uint32 FindSlot(const Key &key) const;
+			void Grow();
+	};
+
+#endif
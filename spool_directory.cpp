@@ -0,0 +1,147 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spool_directory.h"
+#include "types.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+/* Windows. */
+#ifdef WIN_SYSTEM
+	#define WIN32_LEAN_AND_MEAN
+	#include "windows.h"
+	#undef WIN32_LEAN_AND_MEAN
+/* Unix. */
+#elif UNIX_SYSTEM
+	#include <dirent.h>
+	#include <unistd.h>
+	#ifdef __linux__
+		#include <poll.h>
+		#include <sys/inotify.h>
+	#endif
+#endif
+
+using namespace std;
+
+const char SpoolDirectory::JOB_FILE_SUFFIX[] = ".job";
+
+SpoolDirectory::SpoolDirectory(const char *path){
+	this->path = path;
+	inotify_file_descriptor = -1;
+
+	#if defined(UNIX_SYSTEM) && defined(__linux__)
+		if((inotify_file_descriptor = inotify_init()) == -1)
+			throw SpoolDirectoryException("The inotify instance could not be created.");
+		if(inotify_add_watch(inotify_file_descriptor , path , IN_CLOSE_WRITE | IN_MOVED_TO) == -1){
+			close(inotify_file_descriptor);
+			throw SpoolDirectoryException(string("The directory \"") + path + "\" could not be watched.");
+		}
+	#endif
+}
+
+SpoolDirectory::~SpoolDirectory(){
+	#if defined(UNIX_SYSTEM) && defined(__linux__)
+		close(inotify_file_descriptor);
+	#endif
+}
+
+string SpoolDirectory::GetFilePath(const string &file_name) const{
+	#ifdef WIN_SYSTEM
+		const char separator = '\\';
+	#elif UNIX_SYSTEM
+		const char separator = '/';
+	#endif
+
+	if(!path.empty() && path[path.size() - 1] != separator)
+		return path + separator + file_name;
+	return path + file_name;
+}
+
+void SpoolDirectory::WaitForJobFiles(vector<string> &job_files , set<string> &skipped_job_files ,
+	uint32 timeout_milliseconds){
+	ListJobFiles(job_files , skipped_job_files);
+	if(!job_files.empty()) return;
+
+	#if defined(UNIX_SYSTEM) && defined(__linux__)
+		struct pollfd poll_file_descriptor;
+		poll_file_descriptor.fd = inotify_file_descriptor;
+		poll_file_descriptor.events = POLLIN;
+		if(poll(&poll_file_descriptor , 1 , (int)timeout_milliseconds) > 0){
+			/* The events are only used to wake up, the directory is listed again. */
+			uint8 buffer[4096];
+			if(read(inotify_file_descriptor , buffer , sizeof(buffer)) == -1)
+				throw SpoolDirectoryException(string("Error while watching the directory \"") + path + "\".");
+		}
+	#else
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeout_milliseconds));
+	#endif
+	ListJobFiles(job_files , skipped_job_files);
+}
+
+bool HasJobFileSuffix(const char *file_name){
+	size_t length = strlen(file_name) , suffix_length = strlen(SpoolDirectory::JOB_FILE_SUFFIX);
+	return length > suffix_length &&
+		!strcmp(file_name + length - suffix_length , SpoolDirectory::JOB_FILE_SUFFIX);
+}
+
+void SpoolDirectory::ListJobFiles(vector<string> &job_files , set<string> &skipped_job_files){
+	set<string> listed_skipped_job_files;
+
+	job_files.clear();
+	/* Windows. */
+	#ifdef WIN_SYSTEM
+		WIN32_FIND_DATAA find_data;
+		HANDLE find_handle = FindFirstFileA(GetFilePath(string("*") + JOB_FILE_SUFFIX).c_str() , &find_data);
+		if(find_handle == INVALID_HANDLE_VALUE){
+			if(GetLastError() == ERROR_FILE_NOT_FOUND) return;
+			throw SpoolDirectoryException(string("The directory \"") + path + "\" could not be read.");
+		}
+		do{
+			if(!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && HasJobFileSuffix(find_data.cFileName))
+				job_files.push_back(find_data.cFileName);
+		}while(FindNextFileA(find_handle , &find_data));
+		FindClose(find_handle);
+	/* Unix. */
+	#elif UNIX_SYSTEM
+		DIR *directory;
+		struct dirent *entry;
+		if((directory = opendir(path.c_str())) == NULL)
+			throw SpoolDirectoryException(string("The directory \"") + path + "\" could not be read.");
+		while((entry = readdir(directory)) != NULL){
+			if(entry->d_name[0] != '.' && HasJobFileSuffix(entry->d_name))
+				job_files.push_back(entry->d_name);
+		}
+		closedir(directory);
+	#endif
+	sort(job_files.begin() , job_files.end());
+
+	/* The skipped job files are left out, so a directory that only has them is waited on. */
+	for(vector<string>::iterator iterator = job_files.begin() ; iterator != job_files.end() ;){
+		if(skipped_job_files.count(*iterator) != 0){
+			listed_skipped_job_files.insert(*iterator);
+			iterator = job_files.erase(iterator);
+		}else{
+			iterator++;
+		}
+	}
+	skipped_job_files.swap(listed_skipped_job_files);
+}
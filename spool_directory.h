@@ -0,0 +1,68 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Spool Directory Module: watches a directory where job files are dropped.
+ */
+
+#ifndef YAFS_SPOOL_DIRECTORY_H
+	#define YAFS_SPOOL_DIRECTORY_H
+
+	#include "exception.h"
+	#include "types.h"
+
+	#include <set>
+	#include <string>
+	#include <vector>
+	using namespace std;
+
+	class SpoolDirectory {
+		public:
+			SpoolDirectory(const char *path);
+			~SpoolDirectory();
+
+			/* Waits until the directory has job files that are not in skipped_job_files or
+				the timeout expires and returns the names of these job files sorted. The names
+				of the skipped job files that are no longer in the directory are removed from
+				the set. On Linux the directory is watched with inotify, on the other systems
+				it is checked again after the timeout. */
+			void WaitForJobFiles(vector<string> &job_files , set<string> &skipped_job_files ,
+				uint32 timeout_milliseconds);
+			string GetFilePath(const string &file_name) const;
+
+			/* Only the files with this suffix are jobs. The other files are ignored, so a
+				job file can be created with another name and renamed when it is complete. */
+			static const char JOB_FILE_SUFFIX[];
+
+			class SpoolDirectoryException : public Exception {
+				public:
+					SpoolDirectoryException(string message = ""):Exception(message){}
+			};
+
+		private:
+			SpoolDirectory(const SpoolDirectory&);
+			SpoolDirectory& operator=(const SpoolDirectory&);
+
+			void ListJobFiles(vector<string> &job_files , set<string> &skipped_job_files);
+
+			string path;
+			int inotify_file_descriptor;
+	};
+
+#endif
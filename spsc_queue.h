@@ -0,0 +1,140 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SPSC Queue Module: a bounded lock free queue with one producer thread and one
+ * consumer thread. A thread that has to wait spins for a while and then sleeps.
+ */
+
+#ifndef YAFS_SPSC_QUEUE_H
+	#define YAFS_SPSC_QUEUE_H
+
+	#include "types.h"
+
+	#include <atomic>
+	#include <condition_variable>
+	#include <mutex>
+	#include <thread>
+
+	template <class T> class SPSCQueue {
+		public:
+			/* The capacity is rounded up to a power of two. */
+			SPSCQueue(uint32 capacity){
+				for(this->capacity = 1 ; this->capacity < capacity ; this->capacity <<= 1);
+				items = new T[this->capacity];
+				head = tail = 0;
+				producer_waiting = consumer_waiting = false;
+			}
+			~SPSCQueue(){
+				delete[] items;
+			}
+
+			/* Returns false if the queue is full. Only the producer thread may call it. */
+			bool TryPush(const T &item){
+				uint32 current_tail = tail.load(std::memory_order_relaxed);
+
+				if(current_tail - head.load(std::memory_order_acquire) == capacity) return false;
+				items[current_tail & (capacity - 1)] = item;
+				tail.store(current_tail + 1 , std::memory_order_release);
+				return true;
+			}
+			/* Returns false if the queue is empty. Only the consumer thread may call it. */
+			bool TryPop(T &item){
+				uint32 current_head = head.load(std::memory_order_relaxed);
+
+				if(current_head == tail.load(std::memory_order_acquire)) return false;
+				item = items[current_head & (capacity - 1)];
+				head.store(current_head + 1 , std::memory_order_release);
+				return true;
+			}
+			/* Waits until the item is pushed or stopping is set. Returns false if stopping
+				is set. Only the producer thread may call it. */
+			bool Push(const T &item , const std::atomic<bool> &stopping){
+				for(uint32 spins = 0 ; !TryPush(item) ; spins++){
+					if(stopping) return false;
+					if(spins < SPIN_LIMIT){
+						std::this_thread::yield();
+					}else{
+						Sleep(producer_waiting , [this , &stopping](){
+							return tail.load() - head.load() < capacity || stopping;
+						});
+					}
+				}
+				WakeUp(consumer_waiting);
+				return true;
+			}
+			/* Waits until an item is popped or stopping is set. Returns false if stopping
+				is set. Only the consumer thread may call it. */
+			bool Pop(T &item , const std::atomic<bool> &stopping){
+				for(uint32 spins = 0 ; !TryPop(item) ; spins++){
+					if(stopping) return false;
+					if(spins < SPIN_LIMIT){
+						std::this_thread::yield();
+					}else{
+						Sleep(consumer_waiting , [this , &stopping](){
+							return tail.load() != head.load() || stopping;
+						});
+					}
+				}
+				WakeUp(producer_waiting);
+				return true;
+			}
+			/* Wakes up the threads sleeping in Push or Pop, so they see that stopping was set. */
+			void WakeUpAll(){
+				std::lock_guard<std::mutex> lock(mutex);
+				condition.notify_all();
+			}
+
+		private:
+			/* The number of times Push and Pop yield before they sleep. */
+			static const uint32 SPIN_LIMIT = 64;
+
+			SPSCQueue(const SPSCQueue&);
+			SPSCQueue& operator=(const SPSCQueue&);
+
+			T *items;
+			uint32 capacity;
+			/* The positions only grow, so the difference is the number of items. They are
+				kept in different cache lines so the threads do not invalidate each other. */
+			alignas(64) std::atomic<uint32> head;
+			alignas(64) std::atomic<uint32> tail;
+			/* The flag of a sleeping thread is set before it checks the queue again and the
+				other thread checks it after changing the queue, so a wake up is not lost. */
+			std::atomic<bool> producer_waiting , consumer_waiting;
+			std::mutex mutex;
+			std::condition_variable condition;
+
+			template <class Predicate> void Sleep(std::atomic<bool> &waiting , Predicate can_continue){
+				std::unique_lock<std::mutex> lock(mutex);
+
+				waiting = true;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				condition.wait(lock , can_continue);
+				waiting = false;
+			}
+			void WakeUp(std::atomic<bool> &waiting){
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(waiting){
+					std::lock_guard<std::mutex> lock(mutex);
+					condition.notify_all();
+				}
+			}
+	};
+
+#endif
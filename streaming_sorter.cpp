@@ -0,0 +1,213 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "streaming_sorter.h"
+#include "utils.h"
+#include "xercesc.h"
+
+#include <iostream>
+/* Xerces includes: */
+#include <xercesc/util/XMLUni.hpp>
+
+using namespace std;
+XERCES_CPP_NAMESPACE_USE
+
+const XMLCh root_utf16_str[] = {
+	chLatin_r ,
+	chLatin_o ,
+	chLatin_o ,
+	chLatin_t ,
+	0x0
+};
+
+StreamingSorter::StreamingSorter(FATDevice *fat_device){
+	this->fat_device = fat_device;
+	writing = reading_short_name = element_is_directory = saw_errors = false;
+	element_order = largest_directory_size = 0;
+}
+
+void StreamingSorter::Sort(const char *xml_file){
+	Xercesc::Initialize();
+
+	try{
+		writing = false;
+		Parse(xml_file);
+		writing = true;
+		Parse(xml_file);
+	}catch(...){
+		frames.clear();
+		root_directory.reset();
+		Xercesc::Terminate();
+		throw;
+	}
+	Xercesc::Terminate();
+
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The largest directory sorted has " << largest_directory_size <<
+			" elements." << endl;
+	}
+}
+
+void StreamingSorter::Parse(const char *xml_file){
+	const string schema_path = ExecutableDirectoryUtils::GetExecutableDirectoryNativeEncoding() +
+		xsd_file_name;
+	std::unique_ptr<SAX2XMLReader> reader(Xercesc::CreateSAX2XMLReader(schema_path));
+	XMLCh *schema_location = XMLString::transcode(schema_path.c_str());
+
+	frames.clear();
+	root_directory.reset();
+	reading_short_name = saw_errors = false;
+	errors_buffer.str("");
+
+	reader->setProperty(XMLUni::fgXercesSchemaExternalNoNameSpaceSchemaLocation , schema_location);
+	reader->setContentHandler(this);
+	reader->setErrorHandler(this);
+	try{
+		reader->parse(xml_file);
+	}catch(XMLException &xml_exception){
+		char *message_buffer = XMLString::transcode(xml_exception.getMessage());
+		string message(message_buffer);
+		XMLString::release(&message_buffer);
+		XMLString::release(&schema_location);
+		throw RootDirectory::RootDirectoryException(message);
+	}catch(...){
+		XMLString::release(&schema_location);
+		throw;
+	}
+	XMLString::release(&schema_location);
+
+	if(saw_errors){
+		cerr << errors_buffer.str() << endl;
+		throw RootDirectory::RootDirectoryException(errors_buffer.str());
+	}
+	/* The file ended before the root element was closed. */
+	if(!frames.empty()) ThrowDoNotMatchException();
+}
+
+void StreamingSorter::startElement(const XMLCh* const , const XMLCh* const local_name ,
+	const XMLCh* const , const Attributes &attributes){
+	/* After an error, the elements are only validated. */
+	if(saw_errors) return;
+
+	if(XMLString::equals(root_utf16_str , local_name)){
+		root_directory.reset(fat_device->ReadRootDirectory());
+		frames.push_back(Frame());
+		frames.back().fat_directory = NULL;
+		frames.back().children_reordered = 0;
+	}else if(XMLString::equals(file_utf16_str , local_name) ||
+		XMLString::equals(directory_utf16_str , local_name)){
+		element_is_directory = XMLString::equals(directory_utf16_str , local_name);
+		/* The Validation guarantees that order attribute will always exist. */
+		XMLString::textToBin(attributes.getValue(order_utf16_str) , element_order);
+		short_name.clear();
+	}else if(XMLString::equals(short_name_utf16_str , local_name)){
+		reading_short_name = true;
+	}
+}
+
+void StreamingSorter::characters(const XMLCh* const chars , const XMLSize_t length){
+	if(reading_short_name) short_name.append(chars , length);
+}
+
+void StreamingSorter::endElement(const XMLCh* const , const XMLCh* const local_name ,
+	const XMLCh* const){
+	if(saw_errors) return;
+
+	if(XMLString::equals(short_name_utf16_str , local_name)){
+		reading_short_name = false;
+		ReorderElement();
+	}else if(XMLString::equals(directory_utf16_str , local_name) ||
+		XMLString::equals(root_utf16_str , local_name)){
+		FinishDirectory();
+	}
+}
+
+void StreamingSorter::ReorderElement(){
+	Frame &frame = frames.back();
+	FATElement *fat_element;
+	uint8 dir_name[11];
+	bool reordered;
+
+	if(!ConvertShortNameToDIRName(short_name.c_str() , dir_name))
+		ThrowDoNotMatchException(short_name.c_str());
+	if(frame.fat_directory != NULL){
+		reordered = frame.fat_directory->ReorderFATElement(dir_name , element_order , &fat_element);
+	}else{
+		reordered = root_directory->ReorderFATElement(dir_name , element_order , &fat_element);
+	}
+	if(!reordered) ThrowDoNotMatchException(short_name.c_str());
+	frame.children_reordered++;
+
+	/* The content of the directory is read only when its element is reached. */
+	if(element_is_directory){
+		if(!fat_element->IsDirectory()) ThrowDoNotMatchException();
+		fat_device->ReadDirectoryContent((FATDirectory*)fat_element);
+		frames.push_back(Frame());
+		frames.back().fat_directory = (FATDirectory*)fat_element;
+		frames.back().children_reordered = 0;
+	}
+}
+
+void StreamingSorter::FinishDirectory(){
+	Frame &frame = frames.back();
+	vector<FATElement*> &content = frame.fat_directory != NULL ? frame.fat_directory->content :
+		root_directory->content;
+
+	if(frame.children_reordered != content.size())
+		ThrowDoNotMatchException();
+	if(content.size() > largest_directory_size) largest_directory_size = (uint32)content.size();
+
+	FATElement::SortByOrder(content);
+	if(writing){
+		if(frame.fat_directory != NULL){
+			fat_device->WriteDirectoryContent(frame.fat_directory);
+		}else{
+			fat_device->WriteRootDirectoryContent(root_directory.get());
+		}
+	}
+
+	/* The elements of the directory are not needed anymore. */
+	if(frame.fat_directory != NULL){
+		for(uint32 i = 0 ; i < content.size() ; i++)
+			delete content[i];
+		content.clear();
+	}else{
+		root_directory.reset();
+	}
+	frames.pop_back();
+}
+
+void StreamingSorter::warning(const SAXParseException &exception){
+	char *message = XMLString::transcode(exception.getMessage());
+	cerr << "Warning at line " << exception.getLineNumber() << ": " <<
+		message << "." << endl;
+	XMLString::release(&message);
+}
+
+void StreamingSorter::error(const SAXParseException &exception){
+	char *message = XMLString::transcode(exception.getMessage());
+	saw_errors = true;
+	errors_buffer << "Error at line " << exception.getLineNumber() << ": " <<
+		message << "." << endl;
+	XMLString::release(&message);
+}
+
+void StreamingSorter::fatalError(const SAXParseException &exception){
+	error(exception);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Streaming Sorter Module: sorts a device reading the input file and the directories one
+ * at a time, so only the directories on the current path are kept in memory.
+ */
+
+#ifndef YAFS_STREAMING_SORTER_H
+	#define YAFS_STREAMING_SORTER_H
+
+	#include "exception.h"
+	#include "fat_device.h"
+	#include "fat_elements.h"
+	#include "types.h"
+
+	#include <memory>
+	#include <sstream>
+	#include <string>
+	#include <vector>
+	/* Xerces includes: */
+	#include <xercesc/sax2/Attributes.hpp>
+	#include <xercesc/sax2/DefaultHandler.hpp>
+	using namespace std;
+	XERCES_CPP_NAMESPACE_USE
+
+	class StreamingSorter : public DefaultHandler {
+		public:
+			StreamingSorter(FATDevice *fat_device);
+
+			/* The input file is read twice. The first time, it is only checked against
+				the device, so nothing is written if some directory does not match. The
+				second time, each directory is written when its end is reached. */
+			void Sort(const char *xml_file);
+
+			void startElement(const XMLCh* const uri , const XMLCh* const local_name ,
+				const XMLCh* const q_name , const Attributes &attributes);
+			void endElement(const XMLCh* const uri , const XMLCh* const local_name ,
+				const XMLCh* const q_name);
+			void characters(const XMLCh* const chars , const XMLSize_t length);
+			void warning(const SAXParseException &exception);
+			void error(const SAXParseException &exception);
+			void fatalError(const SAXParseException &exception);
+
+		private:
+			/* A directory whose end was not reached. The root directory has fat_directory
+				equal to NULL. */
+			struct Frame {
+				FATDirectory *fat_directory;
+				uint32 children_reordered;
+			};
+
+			FATDevice *fat_device;
+			bool writing , reading_short_name , element_is_directory , saw_errors;
+			uint32 element_order , largest_directory_size;
+			basic_string<XMLCh> short_name;
+			std::unique_ptr<RootDirectory> root_directory;
+			vector<Frame> frames;
+			stringstream errors_buffer;
+
+			void Parse(const char *xml_file);
+			void ReorderElement();
+			void FinishDirectory();
+	};
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread_pool.h"
+#include "types.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(uint32 number_of_threads){
+	pending_tasks = 0;
+	stopping = false;
+
+	if(number_of_threads == 0)
+		number_of_threads = thread::hardware_concurrency();
+	if(number_of_threads == 0)
+		number_of_threads = 1;
+	for(uint32 i = 0 ; i < number_of_threads ; i++)
+		threads.push_back(thread(&ThreadPool::Work , this));
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		unique_lock<mutex> lock(tasks_mutex);
+		stopping = true;
+	}
+	task_available.notify_all();
+	for(uint32 i = 0 ; i < threads.size() ; i++)
+		threads[i].join();
+}
+
+void ThreadPool::Submit(const function<void()> &task){
+	{
+		unique_lock<mutex> lock(tasks_mutex);
+		tasks.push_back(task);
+		pending_tasks++;
+	}
+	task_available.notify_one();
+}
+
+void ThreadPool::Wait(){
+	unique_lock<mutex> lock(tasks_mutex);
+
+	while(pending_tasks > 0)
+		all_tasks_done.wait(lock);
+	if(first_exception){
+		exception_ptr exception = first_exception;
+		first_exception = exception_ptr();
+		rethrow_exception(exception);
+	}
+}
+
+void ThreadPool::Work(){
+	unique_lock<mutex> lock(tasks_mutex);
+
+	for(;;){
+		while(tasks.empty() && !stopping)
+			task_available.wait(lock);
+		if(tasks.empty()) return;
+
+		function<void()> task = tasks.front();
+		tasks.pop_front();
+		lock.unlock();
+		try{
+			task();
+		}catch(...){
+			lock.lock();
+			if(!first_exception) first_exception = current_exception();
+			lock.unlock();
+		}
+		lock.lock();
+		if(--pending_tasks == 0) all_tasks_done.notify_all();
+	}
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Thread Pool Module: runs tasks on a fixed set of worker threads.
+ */
+
+#ifndef YAFS_THREAD_POOL_H
+	#define YAFS_THREAD_POOL_H
+
+	#include "types.h"
+
+	#include <condition_variable>
+	#include <deque>
+	#include <exception>
+	#include <functional>
+	#include <mutex>
+	#include <thread>
+	#include <vector>
+
+	class ThreadPool {
+		public:
+			/* With zero threads the number of hardware threads is used. */
+			ThreadPool(uint32 number_of_threads = 0);
+			~ThreadPool();
+
+			/* A task can submit other tasks. */
+			void Submit(const std::function<void()> &task);
+			/* Waits until all tasks, including the ones submitted by other tasks, have
+				finished. If a task has thrown an exception, the first one is rethrown here. */
+			void Wait();
+
+			uint32 GetNumberOfThreads() const{
+				return (uint32)threads.size();
+			}
+
+		private:
+			ThreadPool(const ThreadPool&);
+			ThreadPool& operator=(const ThreadPool&);
+
+			std::vector<std::thread> threads;
+			std::deque<std::function<void()> > tasks;
+			std::mutex tasks_mutex;
+			std::condition_variable task_available , all_tasks_done;
+			uint32 pending_tasks;
+			bool stopping;
+			std::exception_ptr first_exception;
+
+			void Work();
+	};
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checksum.h"
+#include "pack.h"
+#include "tree_snapshot.h"
+#include "types.h"
+#include "unicode.h"
+#include "utils.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+#define TREE_SNAPSHOT_SIGNATURE "YAFSSNAP"
+#define TREE_SNAPSHOT_VERSION 3
+
+/* File format: a header followed by number_of_directories directories. A directory is its
+	first cluster, its fingerprint, its "." and ".." entries, its number of elements and
+	the elements. An element is its number of directory entries, the entries, the short
+	name length, the short name, the long name length plus one (zero if it has no long
+	name) and the long name. The numbers are stored in the byte order of the machine, like
+	the FAT structures are read, so a snapshot is only used by the machine that stored it. */
+PACK(struct TreeSnapshotHeader{
+	uint8 signature[8];
+	uint32 version;
+	uint32 volume_id;
+	uint8 volume_label[11];
+	/* The names are decoded with this code page. */
+	uint8 code_page;
+	uint32 key_checksum;
+	uint32 number_of_directories;
+	uint32 content_size;
+	/* The checksum of the content. */
+	uint32 content_checksum;
+});
+#ifndef __APPLE__
+	static_assert(sizeof(TreeSnapshotHeader) == 44, "Expecting TreeSnapshotHeader with 44 bytes length");
+#endif
+
+void AppendBytes(vector<uint8> &buffer , const void *data , size_t size){
+	buffer.insert(buffer.end() , (const uint8*)data , (const uint8*)data + size);
+}
+
+void AppendUInt32(vector<uint8> &buffer , uint32 value){
+	AppendBytes(buffer , &value , sizeof(uint32));
+}
+
+bool ExtractBytes(const vector<uint8> &buffer , size_t &position , void *data , size_t size){
+	if(buffer.size() - position < size) return false;
+	memcpy(data , buffer.data() + position , size);
+	position += size;
+	return true;
+}
+
+bool ExtractString(const vector<uint8> &buffer , size_t &position , uint32 length , string &value){
+	if(buffer.size() - position < length) return false;
+	value.assign((const char*)buffer.data() + position , length);
+	position += length;
+	/* The names are used as C strings. */
+	return value.find('\0') == string::npos;
+}
+
+TreeSnapshot::TreeSnapshot(){
+	number_of_restored_directories = 0;
+}
+
+void TreeSnapshot::AddDirectory(uint32 first_cluster , uint32 fingerprint ,
+	FATDirectory *fat_directory , RootDirectory *root_directory){
+	const vector<FATElement*> &content = fat_directory != NULL ? fat_directory->content :
+		root_directory->content;
+	Directory &directory = directories[first_cluster];
+
+	directory.fingerprint = fingerprint;
+	if(fat_directory != NULL){
+		directory.dot = fat_directory->dot;
+		directory.dotdot = fat_directory->dotdot;
+	}else{
+		memset(&directory.dot , 0 , sizeof(DirectoryEntryStructure));
+		memset(&directory.dotdot , 0 , sizeof(DirectoryEntryStructure));
+	}
+	directory.elements.resize(content.size());
+	for(uint32 i = 0 ; i < content.size() ; i++){
+		Element &element = directory.elements[i];
+		element.directory_entries = content[i]->directory_entries;
+		element.short_name = (const char*)content[i]->short_name;
+		element.has_long_name = content[i]->long_name != NULL;
+		element.long_name = element.has_long_name ? (const char*)content[i]->long_name : "";
+	}
+}
+
+void TreeSnapshot::AddDirectories(const TreeSnapshot &tree_snapshot){
+	directories.insert(tree_snapshot.directories.begin() , tree_snapshot.directories.end());
+}
+
+bool TreeSnapshot::RestoreDirectory(uint32 first_cluster , uint32 fingerprint ,
+	FATDirectory *fat_directory , RootDirectory *root_directory){
+	map<uint32 , Directory>::const_iterator iterator = directories.find(first_cluster);
+
+	if(iterator == directories.end() || iterator->second.fingerprint != fingerprint)
+		return false;
+
+	const Directory &directory = iterator->second;
+	if(fat_directory != NULL){
+		fat_directory->dot = directory.dot;
+		fat_directory->dotdot = directory.dotdot;
+	}
+	for(uint32 i = 0 ; i < directory.elements.size() ; i++){
+		const Element &element = directory.elements[i];
+		FATElement *fat_element = FATElementFactory::CreateFATElement(element.directory_entries ,
+			(const uint8*)element.short_name.c_str() ,
+			element.has_long_name ? (const uint8*)element.long_name.c_str() : NULL);
+		if(fat_directory != NULL){
+			fat_directory->InsertFATElement(fat_element);
+		}else{
+			root_directory->InsertFATElement(fat_element);
+		}
+	}
+	number_of_restored_directories++;
+	return true;
+}
+
+bool TreeSnapshot::Save(const string &path , const TreeSnapshotKey &key) const{
+	static std::atomic<uint32> temporary_file_counter(0);
+	TreeSnapshotHeader header;
+	vector<uint8> content;
+	stringstream temporary_path;
+	FILE *file;
+	bool success;
+
+	for(map<uint32 , Directory>::const_iterator iterator = directories.begin() ;
+		iterator != directories.end() ; iterator++){
+		const Directory &directory = iterator->second;
+		AppendUInt32(content , iterator->first);
+		AppendUInt32(content , directory.fingerprint);
+		AppendBytes(content , &directory.dot , sizeof(DirectoryEntryStructure));
+		AppendBytes(content , &directory.dotdot , sizeof(DirectoryEntryStructure));
+		AppendUInt32(content , (uint32)directory.elements.size());
+		for(uint32 i = 0 ; i < directory.elements.size() ; i++){
+			const Element &element = directory.elements[i];
+			AppendUInt32(content , (uint32)element.directory_entries.size());
+			AppendBytes(content , element.directory_entries.data() ,
+				element.directory_entries.size() * sizeof(GenericEntry));
+			AppendUInt32(content , (uint32)element.short_name.size());
+			AppendBytes(content , element.short_name.data() , element.short_name.size());
+			AppendUInt32(content , element.has_long_name ? (uint32)element.long_name.size() + 1 : 0);
+			AppendBytes(content , element.long_name.data() , element.long_name.size());
+		}
+	}
+
+	memcpy(header.signature , TREE_SNAPSHOT_SIGNATURE , sizeof(header.signature));
+	header.version = TREE_SNAPSHOT_VERSION;
+	header.volume_id = key.volume_id;
+	memcpy(header.volume_label , key.volume_label , sizeof(header.volume_label));
+	header.code_page = (uint8)Unicode::GetCodePage();
+	header.key_checksum = key.checksum;
+	header.number_of_directories = (uint32)directories.size();
+	header.content_size = (uint32)content.size();
+	header.content_checksum = Checksum::CRC32C(content.data() , content.size());
+
+	/* Other threads or processes may be saving a snapshot of the same volume. */
+	temporary_path << path << "." << hex <<
+		(std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+		(size_t)std::chrono::steady_clock::now().time_since_epoch().count()) <<
+		"." << temporary_file_counter++ << ".tmp";
+	if((file = fopen(temporary_path.str().c_str() , "wb")) == NULL) return false;
+	success = fwrite(&header , sizeof(TreeSnapshotHeader) , 1 , file) == 1 &&
+		fwrite(content.data() , 1 , content.size() , file) == content.size();
+	success = fclose(file) == 0 && success;
+
+	remove(path.c_str());
+	if(!success || rename(temporary_path.str().c_str() , path.c_str())){
+		remove(temporary_path.str().c_str());
+		return false;
+	}
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The tree snapshot \"" << path << "\" was saved (" <<
+			directories.size() << " directories and " << content.size() << " bytes)." << endl;
+	}
+	return true;
+}
+
+bool TreeSnapshot::Load(const string &path , const TreeSnapshotKey &key){
+	TreeSnapshotHeader header;
+	vector<uint8> content;
+	size_t position = 0;
+	FILE *file;
+	bool success;
+
+	directories.clear();
+	if((file = fopen(path.c_str() , "rb")) == NULL) return false;
+	success = fread(&header , sizeof(TreeSnapshotHeader) , 1 , file) == 1 &&
+		!memcmp(header.signature , TREE_SNAPSHOT_SIGNATURE , sizeof(header.signature)) &&
+		header.version == TREE_SNAPSHOT_VERSION &&
+		header.volume_id == key.volume_id &&
+		!memcmp(header.volume_label , key.volume_label , sizeof(header.volume_label)) &&
+		header.code_page == (uint8)Unicode::GetCodePage() &&
+		header.key_checksum == key.checksum;
+	if(success){
+		long content_offset = ftell(file);
+		/* The size is checked before the buffer is allocated. */
+		success = fseek(file , 0 , SEEK_END) == 0 &&
+			ftell(file) - content_offset == (long)header.content_size &&
+			fseek(file , content_offset , SEEK_SET) == 0;
+	}
+	if(success){
+		content.resize(header.content_size);
+		success = fread(content.data() , 1 , content.size() , file) == content.size() &&
+			Checksum::CRC32C(content.data() , content.size()) == header.content_checksum;
+	}
+	fclose(file);
+
+	for(uint32 i = 0 ; success && i < header.number_of_directories ; i++){
+		uint32 first_cluster , number_of_elements;
+		Directory directory;
+
+		success = ExtractBytes(content , position , &first_cluster , sizeof(uint32)) &&
+			ExtractBytes(content , position , &directory.fingerprint , sizeof(uint32)) &&
+			ExtractBytes(content , position , &directory.dot , sizeof(DirectoryEntryStructure)) &&
+			ExtractBytes(content , position , &directory.dotdot , sizeof(DirectoryEntryStructure)) &&
+			ExtractBytes(content , position , &number_of_elements , sizeof(uint32));
+		for(uint32 j = 0 ; success && j < number_of_elements ; j++){
+			uint32 number_of_entries , short_name_length , long_name_length;
+			Element element;
+
+			success = ExtractBytes(content , position , &number_of_entries , sizeof(uint32)) &&
+				number_of_entries > 0 &&
+				(content.size() - position) / sizeof(GenericEntry) >= number_of_entries;
+			if(!success) break;
+			element.directory_entries.resize(number_of_entries);
+			success = ExtractBytes(content , position , element.directory_entries.data() ,
+					number_of_entries * sizeof(GenericEntry)) &&
+				ExtractBytes(content , position , &short_name_length , sizeof(uint32)) &&
+				short_name_length < SHORT_NAME_BUFFER_SIZE &&
+				ExtractString(content , position , short_name_length , element.short_name) &&
+				ExtractBytes(content , position , &long_name_length , sizeof(uint32));
+			if(!success) break;
+			element.has_long_name = long_name_length > 0;
+			success = ExtractString(content , position , element.has_long_name ? long_name_length - 1 : 0 ,
+				element.long_name);
+			directory.elements.push_back(element);
+		}
+		if(success) directories[first_cluster] = directory;
+	}
+	success = success && position == content.size();
+
+	if(!success){
+		directories.clear();
+		if(LogUtils::IsEnabled())
+			LogUtils::Debug() << "The tree snapshot \"" << path << "\" can not be used." << endl;
+		return false;
+	}
+	return true;
+}
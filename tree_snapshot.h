@@ -0,0 +1,91 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Tree Snapshot Module: stores the directories read from a device in a file, so a
+ * directory whose clusters have not changed can be restored without being parsed again.
+ */
+
+#ifndef YAFS_TREE_SNAPSHOT_H
+	#define YAFS_TREE_SNAPSHOT_H
+
+	#include "fat.h"
+	#include "fat_elements.h"
+	#include "types.h"
+
+	#include <map>
+	#include <string>
+	#include <vector>
+	using namespace std;
+
+	/* Identifies the volume a snapshot was created from. */
+	struct TreeSnapshotKey {
+		uint32 volume_id;
+		uint8 volume_label[11];
+		/* The checksum of the boot sector. */
+		uint32 checksum;
+	};
+
+	class TreeSnapshot {
+		public:
+			TreeSnapshot();
+
+			/* Returns false if the file does not exist, is corrupted or has another key. */
+			bool Load(const string &path , const TreeSnapshotKey &key);
+			/* Writes the snapshot to a temporary file that is renamed when complete.
+				Returns false if it could not be written. */
+			bool Save(const string &path , const TreeSnapshotKey &key) const;
+
+			/* Stores the content of a directory. The directories are identified by
+				their first cluster, the root directory (fat_directory equal to NULL) by
+				zero. The fingerprint is the checksum of the directory clusters. */
+			void AddDirectory(uint32 first_cluster , uint32 fingerprint ,
+				FATDirectory *fat_directory , RootDirectory *root_directory);
+			/* Inserts the stored content of the directory if the snapshot has it with the
+				same fingerprint. The subdirectories are not restored. */
+			bool RestoreDirectory(uint32 first_cluster , uint32 fingerprint ,
+				FATDirectory *fat_directory , RootDirectory *root_directory);
+
+			/* Stores the directories of the other snapshot that this one does not have. */
+			void AddDirectories(const TreeSnapshot &tree_snapshot);
+
+			uint32 GetNumberOfDirectories() const{
+				return (uint32)directories.size();
+			}
+			uint32 GetNumberOfRestoredDirectories() const{
+				return number_of_restored_directories;
+			}
+
+		private:
+			struct Element {
+				vector<GenericEntry> directory_entries;
+				string short_name , long_name;
+				bool has_long_name;
+			};
+			struct Directory {
+				uint32 fingerprint;
+				DirectoryEntryStructure dot , dotdot;
+				vector<Element> elements;
+			};
+
+			map<uint32 , Directory> directories;
+			uint32 number_of_restored_directories;
+	};
+
+#endif
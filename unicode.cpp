@@ -20,9 +20,191 @@
 #include "types.h"
 #include "unicode.h"
 
+#include <cstring>
 #include <vector>
 using namespace std;
 
+Unicode::CodePage Unicode::code_page = Unicode::LATIN_1;
+
+/* The UTF-8 representation of a single code page character. */
+struct CharacterUTF8 {
+	uint8 length;
+	uint8 bytes[CODE_PAGE_CHARACTER_UTF8_MAX_SIZE];
+};
+
+constexpr CharacterUTF8 MakeCharacterUTF8(uint16 code){
+	return code < 0x80 ? CharacterUTF8{1 , {uint8(code) , 0 , 0}} :
+		code < 0x800 ? CharacterUTF8{2 , {uint8(0xC0 | (code >> 6)) , uint8(0x80 | (code & 0x3F)) , 0}} :
+		CharacterUTF8{3 , {uint8(0xE0 | (code >> 12)) , uint8(0x80 | ((code >> 6) & 0x3F)) ,
+			uint8(0x80 | (code & 0x3F))}};
+}
+
+/* The characters from 0x00 to 0x7F are ASCII in all supported code pages so
+	only the upper half of each one is described. */
+/* ISO 8859-1: characters from 0x80 to 0xFF. */
+constexpr uint16 latin_1_code_points[128] = {
+	0x0080 , 0x0081 , 0x0082 , 0x0083 , 0x0084 , 0x0085 , 0x0086 , 0x0087 ,
+	0x0088 , 0x0089 , 0x008A , 0x008B , 0x008C , 0x008D , 0x008E , 0x008F ,
+	0x0090 , 0x0091 , 0x0092 , 0x0093 , 0x0094 , 0x0095 , 0x0096 , 0x0097 ,
+	0x0098 , 0x0099 , 0x009A , 0x009B , 0x009C , 0x009D , 0x009E , 0x009F ,
+	0x00A0 , 0x00A1 , 0x00A2 , 0x00A3 , 0x00A4 , 0x00A5 , 0x00A6 , 0x00A7 ,
+	0x00A8 , 0x00A9 , 0x00AA , 0x00AB , 0x00AC , 0x00AD , 0x00AE , 0x00AF ,
+	0x00B0 , 0x00B1 , 0x00B2 , 0x00B3 , 0x00B4 , 0x00B5 , 0x00B6 , 0x00B7 ,
+	0x00B8 , 0x00B9 , 0x00BA , 0x00BB , 0x00BC , 0x00BD , 0x00BE , 0x00BF ,
+	0x00C0 , 0x00C1 , 0x00C2 , 0x00C3 , 0x00C4 , 0x00C5 , 0x00C6 , 0x00C7 ,
+	0x00C8 , 0x00C9 , 0x00CA , 0x00CB , 0x00CC , 0x00CD , 0x00CE , 0x00CF ,
+	0x00D0 , 0x00D1 , 0x00D2 , 0x00D3 , 0x00D4 , 0x00D5 , 0x00D6 , 0x00D7 ,
+	0x00D8 , 0x00D9 , 0x00DA , 0x00DB , 0x00DC , 0x00DD , 0x00DE , 0x00DF ,
+	0x00E0 , 0x00E1 , 0x00E2 , 0x00E3 , 0x00E4 , 0x00E5 , 0x00E6 , 0x00E7 ,
+	0x00E8 , 0x00E9 , 0x00EA , 0x00EB , 0x00EC , 0x00ED , 0x00EE , 0x00EF ,
+	0x00F0 , 0x00F1 , 0x00F2 , 0x00F3 , 0x00F4 , 0x00F5 , 0x00F6 , 0x00F7 ,
+	0x00F8 , 0x00F9 , 0x00FA , 0x00FB , 0x00FC , 0x00FD , 0x00FE , 0x00FF
+};
+
+/* Code page 437: characters from 0x80 to 0xFF. */
+constexpr uint16 cp437_code_points[128] = {
+	0x00C7 , 0x00FC , 0x00E9 , 0x00E2 , 0x00E4 , 0x00E0 , 0x00E5 , 0x00E7 ,
+	0x00EA , 0x00EB , 0x00E8 , 0x00EF , 0x00EE , 0x00EC , 0x00C4 , 0x00C5 ,
+	0x00C9 , 0x00E6 , 0x00C6 , 0x00F4 , 0x00F6 , 0x00F2 , 0x00FB , 0x00F9 ,
+	0x00FF , 0x00D6 , 0x00DC , 0x00A2 , 0x00A3 , 0x00A5 , 0x20A7 , 0x0192 ,
+	0x00E1 , 0x00ED , 0x00F3 , 0x00FA , 0x00F1 , 0x00D1 , 0x00AA , 0x00BA ,
+	0x00BF , 0x2310 , 0x00AC , 0x00BD , 0x00BC , 0x00A1 , 0x00AB , 0x00BB ,
+	0x2591 , 0x2592 , 0x2593 , 0x2502 , 0x2524 , 0x2561 , 0x2562 , 0x2556 ,
+	0x2555 , 0x2563 , 0x2551 , 0x2557 , 0x255D , 0x255C , 0x255B , 0x2510 ,
+	0x2514 , 0x2534 , 0x252C , 0x251C , 0x2500 , 0x253C , 0x255E , 0x255F ,
+	0x255A , 0x2554 , 0x2569 , 0x2566 , 0x2560 , 0x2550 , 0x256C , 0x2567 ,
+	0x2568 , 0x2564 , 0x2565 , 0x2559 , 0x2558 , 0x2552 , 0x2553 , 0x256B ,
+	0x256A , 0x2518 , 0x250C , 0x2588 , 0x2584 , 0x258C , 0x2590 , 0x2580 ,
+	0x03B1 , 0x00DF , 0x0393 , 0x03C0 , 0x03A3 , 0x03C3 , 0x00B5 , 0x03C4 ,
+	0x03A6 , 0x0398 , 0x03A9 , 0x03B4 , 0x221E , 0x03C6 , 0x03B5 , 0x2229 ,
+	0x2261 , 0x00B1 , 0x2265 , 0x2264 , 0x2320 , 0x2321 , 0x00F7 , 0x2248 ,
+	0x00B0 , 0x2219 , 0x00B7 , 0x221A , 0x207F , 0x00B2 , 0x25A0 , 0x00A0
+};
+
+/* Code page 850: characters from 0x80 to 0xFF. */
+constexpr uint16 cp850_code_points[128] = {
+	0x00C7 , 0x00FC , 0x00E9 , 0x00E2 , 0x00E4 , 0x00E0 , 0x00E5 , 0x00E7 ,
+	0x00EA , 0x00EB , 0x00E8 , 0x00EF , 0x00EE , 0x00EC , 0x00C4 , 0x00C5 ,
+	0x00C9 , 0x00E6 , 0x00C6 , 0x00F4 , 0x00F6 , 0x00F2 , 0x00FB , 0x00F9 ,
+	0x00FF , 0x00D6 , 0x00DC , 0x00F8 , 0x00A3 , 0x00D8 , 0x00D7 , 0x0192 ,
+	0x00E1 , 0x00ED , 0x00F3 , 0x00FA , 0x00F1 , 0x00D1 , 0x00AA , 0x00BA ,
+	0x00BF , 0x00AE , 0x00AC , 0x00BD , 0x00BC , 0x00A1 , 0x00AB , 0x00BB ,
+	0x2591 , 0x2592 , 0x2593 , 0x2502 , 0x2524 , 0x00C1 , 0x00C2 , 0x00C0 ,
+	0x00A9 , 0x2563 , 0x2551 , 0x2557 , 0x255D , 0x00A2 , 0x00A5 , 0x2510 ,
+	0x2514 , 0x2534 , 0x252C , 0x251C , 0x2500 , 0x253C , 0x00E3 , 0x00C3 ,
+	0x255A , 0x2554 , 0x2569 , 0x2566 , 0x2560 , 0x2550 , 0x256C , 0x00A4 ,
+	0x00F0 , 0x00D0 , 0x00CA , 0x00CB , 0x00C8 , 0x0131 , 0x00CD , 0x00CE ,
+	0x00CF , 0x2518 , 0x250C , 0x2588 , 0x2584 , 0x00A6 , 0x00CC , 0x2580 ,
+	0x00D3 , 0x00DF , 0x00D4 , 0x00D2 , 0x00F5 , 0x00D5 , 0x00B5 , 0x00FE ,
+	0x00DE , 0x00DA , 0x00DB , 0x00D9 , 0x00FD , 0x00DD , 0x00AF , 0x00B4 ,
+	0x00AD , 0x00B1 , 0x2017 , 0x00BE , 0x00B6 , 0x00A7 , 0x00F7 , 0x00B8 ,
+	0x00B0 , 0x00A8 , 0x00B7 , 0x00B9 , 0x00B3 , 0x00B2 , 0x25A0 , 0x00A0
+};
+
+/* Code page 1252: characters from 0x80 to 0xFF. */
+constexpr uint16 cp1252_code_points[128] = {
+	0x20AC , 0x0081 , 0x201A , 0x0192 , 0x201E , 0x2026 , 0x2020 , 0x2021 ,
+	0x02C6 , 0x2030 , 0x0160 , 0x2039 , 0x0152 , 0x008D , 0x017D , 0x008F ,
+	0x0090 , 0x2018 , 0x2019 , 0x201C , 0x201D , 0x2022 , 0x2013 , 0x2014 ,
+	0x02DC , 0x2122 , 0x0161 , 0x203A , 0x0153 , 0x009D , 0x017E , 0x0178 ,
+	0x00A0 , 0x00A1 , 0x00A2 , 0x00A3 , 0x00A4 , 0x00A5 , 0x00A6 , 0x00A7 ,
+	0x00A8 , 0x00A9 , 0x00AA , 0x00AB , 0x00AC , 0x00AD , 0x00AE , 0x00AF ,
+	0x00B0 , 0x00B1 , 0x00B2 , 0x00B3 , 0x00B4 , 0x00B5 , 0x00B6 , 0x00B7 ,
+	0x00B8 , 0x00B9 , 0x00BA , 0x00BB , 0x00BC , 0x00BD , 0x00BE , 0x00BF ,
+	0x00C0 , 0x00C1 , 0x00C2 , 0x00C3 , 0x00C4 , 0x00C5 , 0x00C6 , 0x00C7 ,
+	0x00C8 , 0x00C9 , 0x00CA , 0x00CB , 0x00CC , 0x00CD , 0x00CE , 0x00CF ,
+	0x00D0 , 0x00D1 , 0x00D2 , 0x00D3 , 0x00D4 , 0x00D5 , 0x00D6 , 0x00D7 ,
+	0x00D8 , 0x00D9 , 0x00DA , 0x00DB , 0x00DC , 0x00DD , 0x00DE , 0x00DF ,
+	0x00E0 , 0x00E1 , 0x00E2 , 0x00E3 , 0x00E4 , 0x00E5 , 0x00E6 , 0x00E7 ,
+	0x00E8 , 0x00E9 , 0x00EA , 0x00EB , 0x00EC , 0x00ED , 0x00EE , 0x00EF ,
+	0x00F0 , 0x00F1 , 0x00F2 , 0x00F3 , 0x00F4 , 0x00F5 , 0x00F6 , 0x00F7 ,
+	0x00F8 , 0x00F9 , 0x00FA , 0x00FB , 0x00FC , 0x00FD , 0x00FE , 0x00FF
+};
+
+/* The UTF-8 tables are generated by the compiler from the code point tables above. */
+#define MAKE_8_CHARACTERS_UTF8(code_points , i) \
+	MakeCharacterUTF8(code_points[i]) , MakeCharacterUTF8(code_points[i + 1]) , \
+	MakeCharacterUTF8(code_points[i + 2]) , MakeCharacterUTF8(code_points[i + 3]) , \
+	MakeCharacterUTF8(code_points[i + 4]) , MakeCharacterUTF8(code_points[i + 5]) , \
+	MakeCharacterUTF8(code_points[i + 6]) , MakeCharacterUTF8(code_points[i + 7])
+#define MAKE_128_CHARACTERS_UTF8(code_points) { \
+	MAKE_8_CHARACTERS_UTF8(code_points , 0) , MAKE_8_CHARACTERS_UTF8(code_points , 8) , \
+	MAKE_8_CHARACTERS_UTF8(code_points , 16) , MAKE_8_CHARACTERS_UTF8(code_points , 24) , \
+	MAKE_8_CHARACTERS_UTF8(code_points , 32) , MAKE_8_CHARACTERS_UTF8(code_points , 40) , \
+	MAKE_8_CHARACTERS_UTF8(code_points , 48) , MAKE_8_CHARACTERS_UTF8(code_points , 56) , \
+	MAKE_8_CHARACTERS_UTF8(code_points , 64) , MAKE_8_CHARACTERS_UTF8(code_points , 72) , \
+	MAKE_8_CHARACTERS_UTF8(code_points , 80) , MAKE_8_CHARACTERS_UTF8(code_points , 88) , \
+	MAKE_8_CHARACTERS_UTF8(code_points , 96) , MAKE_8_CHARACTERS_UTF8(code_points , 104) , \
+	MAKE_8_CHARACTERS_UTF8(code_points , 112) , MAKE_8_CHARACTERS_UTF8(code_points , 120) }
+
+/* Indexed by Unicode::CodePage. */
+constexpr CharacterUTF8 code_pages_utf8[][128] = {
+	MAKE_128_CHARACTERS_UTF8(latin_1_code_points) ,
+	MAKE_128_CHARACTERS_UTF8(cp437_code_points) ,
+	MAKE_128_CHARACTERS_UTF8(cp850_code_points) ,
+	MAKE_128_CHARACTERS_UTF8(cp1252_code_points)
+};
+
+/* Indexed by Unicode::CodePage. */
+const uint16 *const code_pages_code_points[] = {
+	latin_1_code_points ,
+	cp437_code_points ,
+	cp850_code_points ,
+	cp1252_code_points
+};
+
+bool Unicode::GetCodePageByName(const char* name , CodePage &code_page){
+	if(!strcmp(name , "latin1")){
+		code_page = LATIN_1;
+	}else if(!strcmp(name , "cp437")){
+		code_page = CP437;
+	}else if(!strcmp(name , "cp850")){
+		code_page = CP850;
+	}else if(!strcmp(name , "cp1252")){
+		code_page = CP1252;
+	}else{
+		return false;
+	}
+	return true;
+}
+
+uint32 Unicode::ConvertFromCodePageToUTF8(const uint8* text , uint32 length , uint8* text_utf8){
+	const CharacterUTF8 *table = code_pages_utf8[code_page];
+	uint32 i , j , size = 0;
+
+	for(i = 0 ; i < length ; i++){
+		if(text[i] < 0x80){
+			text_utf8[size++] = text[i];
+		}else{
+			const CharacterUTF8 &character = table[text[i] - 0x80];
+			for(j = 0 ; j < character.length ; j++)
+				text_utf8[size++] = character.bytes[j];
+		}
+	}
+	text_utf8[size] = '\0';
+	return size;
+}
+
+bool Unicode::ConvertFromUTF16ToCodePage(const uint16* text , uint8* text_byte ,
+	uint32 max_length , uint32 &length){
+	const uint16 *code_points = code_pages_code_points[code_page];
+	uint32 i , j;
+
+	for(i = 0 ; text[i] ; i++){
+		if(i >= max_length) return false;
+		if(text[i] < 0x80){
+			text_byte[i] = uint8(text[i]);
+		}else{
+			/* It is only used for the few non ASCII characters so a linear search is enough. */
+			for(j = 0 ; j < 128 && code_points[j] != text[i] ; j++);
+			if(j == 128) return false;
+			text_byte[i] = uint8(0x80 + j);
+		}
+	}
+	length = i;
+	return true;
+}
+
 void ConvertToUTF8(uint32 code , vector<uint8> &text_utf8){
 	/* Now convert to UTF8. */
 	if(code < 0x80){
@@ -30,16 +30,47 @@
 	#include <vector>
 	using namespace std;
 
+	/* The code pages used by the table driven conversions have only characters from
+		the Basic Multilingual Plane, so each byte needs at most 3 bytes in UTF-8. */
+	#define CODE_PAGE_CHARACTER_UTF8_MAX_SIZE 3
+
 	class Unicode {
 		public:
          class UnicodeException : public Exception {
 				public:
 					UnicodeException(string message = ""):Exception(message){}
 			};
+
+			/* The code pages that can be used to decode the 8.3 short names. */
+			enum CodePage {
+				LATIN_1 = 0,
+				CP437 = 1,
+				CP850 = 2,
+				CP1252 = 3
+			};
+
+			static bool GetCodePageByName(const char* name , CodePage &code_page);
+			static void SetCodePage(CodePage code_page){
+				Unicode::code_page = code_page;
+			}
+			static CodePage GetCodePage(){
+				return code_page;
+			}
+			/* Converts length bytes using the current code page. The output buffer must have at
+				least length * CODE_PAGE_CHARACTER_UTF8_MAX_SIZE + 1 bytes. Returns the UTF-8 length. */
+			static uint32 ConvertFromCodePageToUTF8(const uint8* text , uint32 length , uint8* text_utf8);
+			/* Converts a null terminated UTF-16 text using the current code page. Returns false if
+				the text has a character that the code page can not represent or if it has more
+				than max_length characters. */
+			static bool ConvertFromUTF16ToCodePage(const uint16* text , uint8* text_byte ,
+				uint32 max_length , uint32 &length);
 			static char* ConvertFromByteToUTF8(const char* text);
 			static char* ConvertFromUTF16ToUTF8(const wchar_t* text);		
 			static vector<uint8> ConvertFromUTF16ToUTF8(vector<uint16> text_utf16);
 			static vector<uint8> ConvertFromByteToUTF8(vector<uint8> text_byte);
+
+		private:
+			static CodePage code_page;
 	};
 
 #endif
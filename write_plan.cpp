@@ -0,0 +1,178 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checksum.h"
+#include "pack.h"
+#include "types.h"
+#include "utils.h"
+#include "write_plan.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+#define WRITE_PLAN_SIGNATURE "YAFSPLAN"
+#define WRITE_PLAN_VERSION 1
+
+/* File format: a header followed by number_of_blocks blocks, each one with a
+	WritePlanBlockHeader followed by its data. The numbers are stored in the byte order of
+	the machine, like the FAT structures are read, so a plan must be applied on a machine
+	with the same byte order. */
+PACK(struct WritePlanHeader{
+	uint8 signature[8];
+	uint32 version;
+	uint32 volume_id;
+	uint32 metadata_checksum;
+	uint32 number_of_blocks;
+	/* The checksum is computed with the checksum field equal to zero. */
+	uint32 checksum;
+});
+#ifndef __APPLE__
+	static_assert(sizeof(WritePlanHeader) == 28, "Expecting WritePlanHeader with 28 bytes length");
+#endif
+
+PACK(struct WritePlanBlockHeader{
+	uint64 offset;
+	uint32 size;
+	/* The checksum of the device content before the block is written. */
+	uint32 original_checksum;
+	/* The checksum of the other fields and of the data. */
+	uint32 checksum;
+});
+#ifndef __APPLE__
+	static_assert(sizeof(WritePlanBlockHeader) == 20, "Expecting WritePlanBlockHeader with 20 bytes length");
+#endif
+
+uint32 ComputeWritePlanHeaderCheckSum(WritePlanHeader header){
+	header.checksum = 0;
+	return Checksum::CRC32C(&header , sizeof(WritePlanHeader));
+}
+
+uint32 ComputeWritePlanBlockCheckSum(WritePlanBlockHeader block_header , const uint8 *data){
+	block_header.checksum = 0;
+	return Checksum::CRC32C(data , block_header.size ,
+		Checksum::CRC32C(&block_header , sizeof(WritePlanBlockHeader)));
+}
+
+WritePlan::WritePlan(){
+	volume_id = 0;
+	metadata_checksum = 0;
+}
+
+void WritePlan::AddBlock(uint64 offset , const uint8 *data , uint32 size , uint32 original_checksum){
+	DeviceBlock block;
+
+	block.offset = offset;
+	block.data.assign(data , data + size);
+	blocks.push_back(block);
+	original_checksums.push_back(original_checksum);
+}
+
+void WritePlan::Save(const char *path) const{
+	WritePlanHeader header;
+	FILE *file;
+	bool success;
+
+	memcpy(header.signature , WRITE_PLAN_SIGNATURE , sizeof(header.signature));
+	header.version = WRITE_PLAN_VERSION;
+	header.volume_id = volume_id;
+	header.metadata_checksum = metadata_checksum;
+	header.number_of_blocks = (uint32)blocks.size();
+	header.checksum = ComputeWritePlanHeaderCheckSum(header);
+
+	if((file = fopen(path , "wb")) == NULL)
+		throw WritePlanException(string("The plan file \"") + path + "\" could not be created.");
+
+	success = fwrite(&header , sizeof(WritePlanHeader) , 1 , file) == 1;
+	for(uint32 i = 0 ; i < blocks.size() && success ; i++){
+		WritePlanBlockHeader block_header;
+		block_header.offset = blocks[i].offset;
+		block_header.size = (uint32)blocks[i].data.size();
+		block_header.original_checksum = original_checksums[i];
+		block_header.checksum = ComputeWritePlanBlockCheckSum(block_header , blocks[i].data.data());
+		success = fwrite(&block_header , sizeof(WritePlanBlockHeader) , 1 , file) == 1 &&
+			fwrite(blocks[i].data.data() , 1 , blocks[i].data.size() , file) == blocks[i].data.size();
+	}
+	success = fclose(file) == 0 && success;
+	if(!success)
+		throw WritePlanException(string("Error while writing the plan file \"") + path + "\".");
+
+	if(LogUtils::IsEnabled()){
+		LogUtils::Debug() << "The plan has " << blocks.size() << " blocks." << endl;
+	}
+}
+
+void WritePlan::Load(const char *path){
+	WritePlanHeader header;
+	FILE *file;
+	long file_size;
+	string error;
+
+	if((file = fopen(path , "rb")) == NULL)
+		throw WritePlanException(string("The plan file \"") + path + "\" could not be opened.");
+	/* The size of each block is checked against the rest of the file before its
+		buffer is allocated, so a corrupted size can not exhaust the memory. */
+	if(fseek(file , 0 , SEEK_END) != 0 || (file_size = ftell(file)) < 0 || fseek(file , 0 , SEEK_SET) != 0){
+		fclose(file);
+		throw WritePlanException(string("The plan file \"") + path + "\" could not be read.");
+	}
+
+	blocks.clear();
+	original_checksums.clear();
+	if(fread(&header , sizeof(WritePlanHeader) , 1 , file) != 1 ||
+		memcmp(header.signature , WRITE_PLAN_SIGNATURE , sizeof(header.signature)) ||
+		header.version != WRITE_PLAN_VERSION ||
+		header.checksum != ComputeWritePlanHeaderCheckSum(header)){
+		error = string("The plan file \"") + path + "\" is invalid.";
+	}
+
+	for(uint32 i = 0 ; error.empty() && i < header.number_of_blocks ; i++){
+		WritePlanBlockHeader block_header;
+		DeviceBlock block;
+
+		if(fread(&block_header , sizeof(WritePlanBlockHeader) , 1 , file) != 1){
+			error = string("The plan file \"") + path + "\" is incomplete.";
+			break;
+		}
+		if(block_header.size > uint64(file_size - ftell(file))){
+			error = string("The plan file \"") + path + "\" is incomplete.";
+			break;
+		}
+		block.offset = block_header.offset;
+		block.data.resize(block_header.size);
+		if(fread(block.data.data() , 1 , block_header.size , file) != block_header.size){
+			error = string("The plan file \"") + path + "\" is incomplete.";
+		}else if(ComputeWritePlanBlockCheckSum(block_header , block.data.data()) != block_header.checksum){
+			error = string("The plan file \"") + path + "\" has a corrupted block.";
+		}else{
+			blocks.push_back(block);
+			original_checksums.push_back(block_header.original_checksum);
+		}
+	}
+	fclose(file);
+
+	if(!error.empty()){
+		blocks.clear();
+		original_checksums.clear();
+		throw WritePlanException(error);
+	}
+	volume_id = header.volume_id;
+	metadata_checksum = header.metadata_checksum;
+}
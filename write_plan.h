@@ -0,0 +1,78 @@
+/*
+ * Copyright 2026 Luis Henrique O. Rios
+ *
+ * This file is part of YAFS.
+ *
+ * YAFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with YAFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Write Plan Module: stores the directory blocks that will be written to a device, so the
+ * tree reading and the XML processing can be done before the device is available.
+ */
+
+#ifndef YAFS_WRITE_PLAN_H
+	#define YAFS_WRITE_PLAN_H
+
+	#include "device_block.h"
+	#include "exception.h"
+	#include "types.h"
+
+	#include <string>
+	#include <vector>
+	using namespace std;
+
+	class WritePlan {
+		public:
+			WritePlan();
+
+			/* Adds a block that will be written. The checksum of the content that it
+				replaces is used to verify the device before the plan is applied. */
+			void AddBlock(uint64 offset , const uint8 *data , uint32 size , uint32 original_checksum);
+			void Save(const char *path) const;
+			/* Reads the plan file checking all its checksums. */
+			void Load(const char *path);
+
+			uint32 GetVolumeID() const{
+				return volume_id;
+			}
+			void SetVolumeID(uint32 volume_id){
+				this->volume_id = volume_id;
+			}
+			/* The checksum of the boot sector and of the first FAT. */
+			uint32 GetMetadataChecksum() const{
+				return metadata_checksum;
+			}
+			void SetMetadataChecksum(uint32 metadata_checksum){
+				this->metadata_checksum = metadata_checksum;
+			}
+			const vector<DeviceBlock>& GetBlocks() const{
+				return blocks;
+			}
+			const vector<uint32>& GetOriginalChecksums() const{
+				return original_checksums;
+			}
+
+			class WritePlanException : public Exception {
+				public:
+					WritePlanException(string message = ""):Exception(message){}
+			};
+
+		private:
+			uint32 volume_id , metadata_checksum;
+			vector<DeviceBlock> blocks;
+			vector<uint32> original_checksums;
+	};
+
+#endif
@@ -20,40 +20,57 @@
 #include "xercesc.h"
 
 #include <cassert>
+#include <memory>
 #include <string>
 /* Xerces includes: */
+#include <xercesc/internal/XMLGrammarPoolImpl.hpp>
+#include <xercesc/sax2/XMLReaderFactory.hpp>
 #include <xercesc/util/PlatformUtils.hpp>
 #include <xercesc/util/TransService.hpp>
+#include <xercesc/util/XMLUni.hpp>
+#include <xercesc/validators/common/Grammar.hpp>
 
 using namespace std;
 XERCES_CPP_NAMESPACE_USE
 
-bool Xercesc::xerces_was_initialized = false;
 XMLTranscoder *Xercesc::xml_transcoder_utf8 = NULL;
+XMLGrammarPool *Xercesc::grammar_pool = NULL;
+bool Xercesc::grammar_was_loaded = false;
+uint32 Xercesc::initialize_count = 0;
+std::mutex Xercesc::xerces_mutex;
 
 void Xercesc::Initialize(){
-	if(xerces_was_initialized) return;
+	std::lock_guard<std::mutex> lock(xerces_mutex);
+
+	if(initialize_count++ > 0) return;
 	try{
 		XMLTransService::Codes res_value;
 
 		XMLPlatformUtils::Initialize();
 		xml_transcoder_utf8 = XMLPlatformUtils::fgTransService->makeNewTranscoderFor("UTF8" ,
 			res_value , 64);
-		xerces_was_initialized = true;
+		grammar_pool = new XMLGrammarPoolImpl(XMLPlatformUtils::fgMemoryManager);
+		grammar_was_loaded = false;
 	}catch(XMLException &xml_exception){
 		char *message_buffer = XMLString::transcode(xml_exception.getMessage());
 		string message(message_buffer);
 		XMLString::release(&message_buffer);
+		initialize_count--;
 		throw XercescException(message);
 	}
 }
 
 void Xercesc::Terminate(){
-	assert(xerces_was_initialized);
+	std::lock_guard<std::mutex> lock(xerces_mutex);
+
+	assert(initialize_count > 0);
+	if(--initialize_count > 0) return;
 	try{
+		delete grammar_pool;
+		grammar_pool = NULL;
 		delete xml_transcoder_utf8;
+		xml_transcoder_utf8 = NULL;
 		XMLPlatformUtils::Terminate();
-		xerces_was_initialized = false;
 	}catch(XMLException &xml_exception){
 		char *message_buffer = XMLString::transcode(xml_exception.getMessage());
 		string message(message_buffer);
@@ -62,7 +79,52 @@ void Xercesc::Terminate(){
 	}
 }
 
+void Xercesc::LoadGrammar(const string &schema_path){
+	if(grammar_was_loaded) return;
+
+	std::unique_ptr<XercesDOMParser> parser = std::unique_ptr<XercesDOMParser>(
+		new XercesDOMParser(0 , XMLPlatformUtils::fgMemoryManager , grammar_pool));
+	parser->setDoNamespaces(true);
+	parser->setDoSchema(true);
+	if(parser->loadGrammar(schema_path.c_str() , Grammar::SchemaGrammarType , true) == NULL)
+		throw XercescException("The schema \"" + schema_path + "\" could not be loaded.");
+	/* A locked pool can be used by several parsers at the same time. */
+	grammar_pool->lockPool();
+	grammar_was_loaded = true;
+}
+
+XercesDOMParser* Xercesc::CreateDOMParser(const string &schema_path){
+	std::lock_guard<std::mutex> lock(xerces_mutex);
+
+	assert(initialize_count > 0);
+	LoadGrammar(schema_path);
+
+	XercesDOMParser *parser = new XercesDOMParser(0 , XMLPlatformUtils::fgMemoryManager , grammar_pool);
+	parser->useCachedGrammarInParse(true);
+	return parser;
+}
+
+SAX2XMLReader* Xercesc::CreateSAX2XMLReader(const string &schema_path){
+	std::lock_guard<std::mutex> lock(xerces_mutex);
+
+	assert(initialize_count > 0);
+	LoadGrammar(schema_path);
+
+	SAX2XMLReader *reader = XMLReaderFactory::createXMLReader(XMLPlatformUtils::fgMemoryManager ,
+		grammar_pool);
+	reader->setFeature(XMLUni::fgSAX2CoreNameSpaces , true);
+	reader->setFeature(XMLUni::fgSAX2CoreValidation , true);
+	reader->setFeature(XMLUni::fgXercesDynamic , false);
+	reader->setFeature(XMLUni::fgXercesSchema , true);
+	reader->setFeature(XMLUni::fgXercesSchemaFullChecking , true);
+	reader->setFeature(XMLUni::fgXercesValidationErrorAsFatal , true);
+	reader->setFeature(XMLUni::fgXercesUseCachedGrammarInParse , true);
+	return reader;
+}
+
 uint8* Xercesc::TranscodeToUTF8(const XMLCh *string){
+	/* The transcoder is shared by all threads. */
+	std::lock_guard<std::mutex> lock(xerces_mutex);
 	const uint32 buffer_length = 4096;
 	uint8* string_utf8 , buffer[buffer_length];
 	size_t size, length;
@@ -80,6 +142,7 @@ uint8* Xercesc::TranscodeToUTF8(const XMLCh *string){
 }
 
 XMLCh* Xercesc::TranscodeFromUTF8(const uint8 *string){
+	std::lock_guard<std::mutex> lock(xerces_mutex);
 	const uint32 buffer_length = 4096;
 	XMLCh *string_xmlch , buffer[buffer_length];
 	uint8 charSizes[buffer_length];
@@ -26,14 +26,29 @@
 
 	#include "exception.h"
 	#include "types.h"
+
+	#include <mutex>
+	#include <string>
 	/* Xerces includes: */
+	#include <xercesc/framework/XMLGrammarPool.hpp>
+	#include <xercesc/parsers/XercesDOMParser.hpp>
+	#include <xercesc/sax2/SAX2XMLReader.hpp>
 	#include <xercesc/util/TransService.hpp>
 	XERCES_CPP_NAMESPACE_USE
 
 	class Xercesc {
 		public:
+			/* The calls are counted, so the library is only terminated by the
+				Terminate call that matches the first Initialize call. */
 			static void Initialize();
 			static void Terminate();
+			/* Creates a parser that validates with the schema. The schema grammar is
+				compiled once and shared by all the parsers created until the library is
+				terminated. */
+			static XercesDOMParser* CreateDOMParser(const string &schema_path);
+			/* Creates a SAX2 reader that validates with the schema while the document is
+				read. It shares the schema grammar with the DOM parsers. */
+			static SAX2XMLReader* CreateSAX2XMLReader(const string &schema_path);
 			static uint8* TranscodeToUTF8(const XMLCh *string);
 			static XMLCh* TranscodeFromUTF8(const uint8 *string);
 
@@ -43,7 +58,13 @@
 			};
 		private:
 			static XMLTranscoder *xml_transcoder_utf8;
-			static bool xerces_was_initialized;
+			static XMLGrammarPool *grammar_pool;
+			static bool grammar_was_loaded;
+			static uint32 initialize_count;
+			static std::mutex xerces_mutex;
+
+			/* It must be called with the mutex locked. */
+			static void LoadGrammar(const string &schema_path);
 	};
 
 #endif